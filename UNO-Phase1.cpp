@@ -6,6 +6,41 @@
 #include <cstdlib>
 #include <stack>
 #include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <exception>
+#include <coroutine>
+#include <deque>
+#include <array>
+#include <condition_variable>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
 #include "json.hpp"
 
 using namespace std;
@@ -83,315 +118,7323 @@ struct Card {
     }
 };
 
+bool canPlayOn(Card c, Card top, Color currentColor) {
+    if (c.type == WILD || c.type == WILD_DRAW_FOUR) return true;
+    if (c.color == currentColor) return true;
+    if (c.type == top.type && c.type != NUMBER) return true;
+    if (c.type == NUMBER && top.type == NUMBER && c.number == top.number) return true;
+    return false;
+}
+
+const int NUM_KINDS = 54;
+const int KIND_LANES = 64;
+const int KIND_WILD = 52;
+const int KIND_WILD_DRAW_FOUR = 53;
+const int DRAW_MOVE = -1;
+const int FULL_DECK_SIZE = 60;
+
+int cardKind(Card c) {
+    if (c.type == WILD) return KIND_WILD;
+    if (c.type == WILD_DRAW_FOUR) return KIND_WILD_DRAW_FOUR;
+    int offset = c.type == NUMBER ? c.number : 10 + (c.type - SKIP);
+    return c.color * 13 + offset;
+}
+
+Card kindToCard(int kind) {
+    if (kind == KIND_WILD) return Card(NONE, WILD);
+    if (kind == KIND_WILD_DRAW_FOUR) return Card(NONE, WILD_DRAW_FOUR);
+    int offset = kind % 13;
+    if (offset < 10) return Card((Color)(kind / 13), NUMBER, offset);
+    return Card((Color)(kind / 13), (Type)(SKIP + offset - 10));
+}
+
+struct KindTable {
+    Type type[NUM_KINDS];
+    Color color[NUM_KINDS];
+    int copies[NUM_KINDS];
+    float inverseCopies[NUM_KINDS];
+    uint64_t playable[NUM_KINDS][5];
+
+    KindTable() {
+        for (int k = 0; k < NUM_KINDS; k++) {
+            Card c = kindToCard(k);
+            type[k] = c.type;
+            color[k] = c.color;
+            copies[k] = c.color == NONE ? 4 : 1;
+            inverseCopies[k] = 1.0f / copies[k];
+        }
+        for (int top = 0; top < NUM_KINDS; top++)
+            for (int col = RED; col <= NONE; col++) {
+                uint64_t mask = 0;
+                for (int k = 0; k < NUM_KINDS; k++)
+                    if (canPlayOn(kindToCard(k), kindToCard(top), (Color)col)) mask |= 1ULL << k;
+                playable[top][col] = mask;
+            }
+    }
+
+    bool isWild(int kind) const {
+        return kind == KIND_WILD || kind == KIND_WILD_DRAW_FOUR;
+    }
+};
+
+const KindTable kindTable;
+
+alignas(64) const uint8_t COLOR_LANES[4][KIND_LANES] = {
+    {255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255}
+};
+
+uint64_t nonzeroLanesScalar(const uint8_t* counts) {
+    uint64_t mask = 0;
+    for (int k = 0; k < KIND_LANES; k++)
+        if (counts[k]) mask |= 1ULL << k;
+    return mask;
+}
+
+void colorCountsScalar(const uint8_t* counts, int out[4]) {
+    for (int c = 0; c < 4; c++) {
+        out[c] = 0;
+        for (int k = c * 13; k < c * 13 + 13; k++) out[c] += counts[k];
+    }
+}
+
+int nthCardScalar(const uint8_t* counts, int r) {
+    int k = 0;
+    while ((r -= counts[k]) >= 0) k++;
+    return k;
+}
+
+inline int nthCardInGroups(const uint8_t* counts, const uint64_t* groups, int r) {
+    int g = 0;
+    while (r >= (int)groups[g]) r -= (int)groups[g++];
+    return g * 8 + nthCardScalar(counts + g * 8, r);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) uint64_t nonzeroLanesAvx2(const uint8_t* counts) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_loadu_si256((const __m256i*)counts);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(counts + 32));
+    uint32_t loZero = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero));
+    uint32_t hiZero = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero));
+    return ~((uint64_t)hiZero << 32 | loZero);
+}
+
+__attribute__((target("avx2"))) void colorCountsAvx2(const uint8_t* counts, int out[4]) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_loadu_si256((const __m256i*)counts);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(counts + 32));
+    for (int c = 0; c < 4; c++) {
+        __m256i a = _mm256_and_si256(lo, _mm256_load_si256((const __m256i*)COLOR_LANES[c]));
+        __m256i b = _mm256_and_si256(hi, _mm256_load_si256((const __m256i*)(COLOR_LANES[c] + 32)));
+        __m256i sums = _mm256_add_epi64(_mm256_sad_epu8(a, zero), _mm256_sad_epu8(b, zero));
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        out[c] = (int)(_mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1));
+    }
+}
+
+__attribute__((target("avx2"))) int nthCardAvx2(const uint8_t* counts, int r) {
+    __m256i zero = _mm256_setzero_si256();
+    alignas(32) uint64_t groups[8];
+    _mm256_store_si256((__m256i*)groups, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)counts), zero));
+    _mm256_store_si256((__m256i*)(groups + 4), _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(counts + 32)), zero));
+    return nthCardInGroups(counts, groups, r);
+}
+
+__attribute__((target("avx512f,avx512bw"))) uint64_t nonzeroLanesAvx512(const uint8_t* counts) {
+    __m512i v = _mm512_loadu_si512(counts);
+    return _mm512_test_epi8_mask(v, v);
+}
+
+__attribute__((target("avx512f"))) inline long long sumEpi64Avx512(__m512i v) {
+    __m256i half = _mm256_add_epi64(_mm512_maskz_extracti64x4_epi64(0xF, v, 0), _mm512_maskz_extracti64x4_epi64(0xF, v, 1));
+    __m128i quarter = _mm_add_epi64(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+    return _mm_cvtsi128_si64(quarter) + _mm_extract_epi64(quarter, 1);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void colorCountsAvx512(const uint8_t* counts, int out[4]) {
+    __m512i v = _mm512_loadu_si512(counts);
+    for (int c = 0; c < 4; c++) {
+        __m512i lanes = _mm512_maskz_mov_epi8(0x1FFFULL << (13 * c), v);
+        out[c] = (int)sumEpi64Avx512(_mm512_sad_epu8(lanes, _mm512_setzero_si512()));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw"))) int nthCardAvx512(const uint8_t* counts, int r) {
+    alignas(64) uint64_t groups[8];
+    _mm512_store_si512(groups, _mm512_sad_epu8(_mm512_loadu_si512(counts), _mm512_setzero_si512()));
+    return nthCardInGroups(counts, groups, r);
+}
+#endif
+
+struct HandKernels {
+    uint64_t (*nonzeroLanes)(const uint8_t*);
+    void (*colorCounts)(const uint8_t*, int*);
+    int (*nthCard)(const uint8_t*, int);
+    string name;
+
+    HandKernels() {
+        nonzeroLanes = nonzeroLanesScalar;
+        colorCounts = colorCountsScalar;
+        nthCard = nthCardScalar;
+        name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            nonzeroLanes = nonzeroLanesAvx512;
+            colorCounts = colorCountsAvx512;
+            nthCard = nthCardAvx512;
+            name = "avx512";
+        } else if (__builtin_cpu_supports("avx2")) {
+            nonzeroLanes = nonzeroLanesAvx2;
+            colorCounts = colorCountsAvx2;
+            nthCard = nthCardAvx2;
+            name = "avx2";
+        }
+#endif
+    }
+};
+
+const HandKernels handKernels;
+
+inline uint64_t legalMoveMask(const uint8_t* counts, uint64_t playable) {
+    return handKernels.nonzeroLanes(counts) & playable;
+}
+
+inline bool hasPlayable(const uint8_t* counts, uint64_t playable) {
+    return legalMoveMask(counts, playable) != 0;
+}
+
+void packInt8Weights(const int8_t* weights, int rows, int stride, int block, int8_t* out) {
+    int blocks = (rows + block - 1) / block;
+    for (int ob = 0; ob < blocks; ob++)
+        for (int i = 0; i < stride; i += 4)
+            for (int lane = 0; lane < block; lane++) {
+                int r = ob * block + lane;
+                for (int k = 0; k < 4; k++) *out++ = r < rows ? weights[(size_t)r * stride + i + k] : 0;
+            }
+}
+
+float quantizeRowScalar(const float* x, int n, int stride, uint8_t* out) {
+    float top = 0;
+    for (int i = 0; i < n; i++) top = max(top, x[i]);
+    float scale = top > 0 ? top / 127.0f : 1.0f;
+    float inv = 1.0f / scale;
+    for (int i = 0; i < n; i++) out[i] = (uint8_t)min(127, max(0, (int)(x[i] * inv + 0.5f)));
+    for (int i = n; i < stride; i++) out[i] = 0;
+    return scale;
+}
+
+void gemmInt8Scalar(const int8_t* packed, int rows, int stride, const uint8_t* x, int count, const float* scales, const float* bias, bool relu, float* out) {
+    for (int b = 0; b < count; b++) {
+        const uint8_t* row = x + (size_t)b * stride;
+        for (int r = 0; r < rows; r++) {
+            const int8_t* w = packed + (size_t)r * stride;
+            int32_t acc = 0;
+            for (int i = 0; i < stride; i++) acc += (int32_t)row[i] * w[i];
+            float v = acc * scales[b] + bias[r];
+            out[(size_t)b * rows + r] = relu && v < 0 ? 0 : v;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) float quantizeRowAvx2(const float* x, int n, int stride, uint8_t* out) {
+    __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 top8 = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i), laneIndex);
+        top8 = _mm256_max_ps(_mm256_maskload_ps(x + i, lanes), top8);
+    }
+    alignas(32) float tops[8];
+    _mm256_store_ps(tops, top8);
+    float top = 0;
+    for (int k = 0; k < 8; k++) top = max(top, tops[k]);
+    float scale = top > 0 ? top / 127.0f : 1.0f;
+    __m256 inv = _mm256_set1_ps(1.0f / scale), half = _mm256_set1_ps(0.5f);
+    __m256i zero = _mm256_setzero_si256(), limit = _mm256_set1_epi32(127);
+    for (int i = 0; i < stride; i += 8) {
+        __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i), laneIndex);
+        __m256i q = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_maskload_ps(x + i, lanes), inv), half));
+        q = _mm256_min_epi32(_mm256_max_epi32(q, zero), limit);
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+        _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(words, words));
+    }
+    return scale;
+}
+
+template <int M>
+__attribute__((target("avx2"))) inline void gemmTileAvx2(const int8_t* packed, int rows, int stride, const uint8_t* x, const float* scales, const float* bias, bool relu, float* out) {
+    __m256i ones = _mm256_set1_epi16(1);
+    __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int ob = 0; ob * 8 < rows; ob++) {
+        const int8_t* w = packed + (size_t)ob * 8 * stride;
+        __m256i acc[M];
+        for (int j = 0; j < M; j++) acc[j] = _mm256_setzero_si256();
+        for (int i = 0; i < stride; i += 4) {
+            __m256i wv = _mm256_loadu_si256((const __m256i*)(w + (size_t)i * 8));
+            for (int j = 0; j < M; j++) {
+                int32_t quad;
+                memcpy(&quad, x + (size_t)j * stride + i, sizeof(quad));
+                acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_set1_epi32(quad), wv), ones));
+            }
+        }
+        __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(rows - ob * 8), laneIndex);
+        __m256 b = _mm256_maskload_ps(bias + ob * 8, lanes);
+        for (int j = 0; j < M; j++) {
+            __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(acc[j]), _mm256_set1_ps(scales[j])), b);
+            if (relu) v = _mm256_max_ps(v, _mm256_setzero_ps());
+            _mm256_maskstore_ps(out + (size_t)j * rows + ob * 8, lanes, v);
+        }
+    }
+}
+
+__attribute__((target("avx2"))) void gemmInt8Avx2(const int8_t* packed, int rows, int stride, const uint8_t* x, int count, const float* scales, const float* bias, bool relu, float* out) {
+    int b = 0;
+    for (; b + 8 <= count; b += 8) gemmTileAvx2<8>(packed, rows, stride, x + (size_t)b * stride, scales + b, bias, relu, out + (size_t)b * rows);
+    for (; b + 4 <= count; b += 4) gemmTileAvx2<4>(packed, rows, stride, x + (size_t)b * stride, scales + b, bias, relu, out + (size_t)b * rows);
+    for (; b < count; b++) gemmTileAvx2<1>(packed, rows, stride, x + (size_t)b * stride, scales + b, bias, relu, out + (size_t)b * rows);
+}
+
+__attribute__((target("avx512f,avx512bw"))) float quantizeRowAvx512(const float* x, int n, int stride, uint8_t* out) {
+    __m512 top16 = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 lanes = (__mmask16)((1u << min(16, n - i)) - 1);
+        top16 = _mm512_mask_max_ps(top16, lanes, _mm512_maskz_loadu_ps(lanes, x + i), top16);
+    }
+    alignas(64) float tops[16];
+    _mm512_store_ps(tops, top16);
+    float top = 0;
+    for (int k = 0; k < 16; k++) top = max(top, tops[k]);
+    float scale = top > 0 ? top / 127.0f : 1.0f;
+    __m512 inv = _mm512_set1_ps(1.0f / scale), half = _mm512_set1_ps(0.5f);
+    __m512i zero = _mm512_setzero_si512(), limit = _mm512_set1_epi32(127);
+    for (int i = 0; i < stride; i += 16) {
+        __mmask16 lanes = (__mmask16)((1u << max(0, min(16, n - i))) - 1);
+        __m512 v = _mm512_add_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(lanes, x + i), inv), half);
+        __m512i q = _mm512_maskz_cvttps_epi32(0xFFFF, v);
+        q = _mm512_maskz_min_epi32(0xFFFF, _mm512_maskz_max_epi32(0xFFFF, q, zero), limit);
+        _mm_storeu_si128((__m128i*)(out + i), _mm512_maskz_cvtepi32_epi8(0xFFFF, q));
+    }
+    return scale;
+}
+
+template <int M>
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) inline void gemmTileVnni(const int8_t* packed, int rows, int stride, const uint8_t* x, const float* scales, const float* bias, bool relu, float* out) {
+    for (int ob = 0; ob * 16 < rows; ob++) {
+        const int8_t* w = packed + (size_t)ob * 16 * stride;
+        __m512i acc[M];
+        for (int j = 0; j < M; j++) acc[j] = _mm512_setzero_si512();
+        for (int i = 0; i < stride; i += 4) {
+            __m512i wv = _mm512_loadu_si512(w + (size_t)i * 16);
+            for (int j = 0; j < M; j++) {
+                int32_t quad;
+                memcpy(&quad, x + (size_t)j * stride + i, sizeof(quad));
+                acc[j] = _mm512_dpbusd_epi32(acc[j], _mm512_set1_epi32(quad), wv);
+            }
+        }
+        __mmask16 lanes = (__mmask16)((1u << min(16, rows - ob * 16)) - 1);
+        __m512 b = _mm512_maskz_loadu_ps(lanes, bias + ob * 16);
+        for (int j = 0; j < M; j++) {
+            __m512 v = _mm512_add_ps(_mm512_mul_ps(_mm512_maskz_cvtepi32_ps(0xFFFF, acc[j]), _mm512_set1_ps(scales[j])), b);
+            if (relu) v = _mm512_maskz_max_ps(0xFFFF, v, _mm512_setzero_ps());
+            _mm512_mask_storeu_ps(out + (size_t)j * rows + ob * 16, lanes, v);
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) void gemmInt8Vnni(const int8_t* packed, int rows, int stride, const uint8_t* x, int count, const float* scales, const float* bias, bool relu, float* out) {
+    int b = 0;
+    for (; b + 8 <= count; b += 8) gemmTileVnni<8>(packed, rows, stride, x + (size_t)b * stride, scales + b, bias, relu, out + (size_t)b * rows);
+    for (; b + 4 <= count; b += 4) gemmTileVnni<4>(packed, rows, stride, x + (size_t)b * stride, scales + b, bias, relu, out + (size_t)b * rows);
+    for (; b < count; b++) gemmTileVnni<1>(packed, rows, stride, x + (size_t)b * stride, scales + b, bias, relu, out + (size_t)b * rows);
+}
+#endif
+
+struct Int8Kernels {
+    float (*quantize)(const float*, int, int, uint8_t*);
+    void (*gemm)(const int8_t*, int, int, const uint8_t*, int, const float*, const float*, bool, float*);
+    int gemmBlock;
+    string name;
+
+    Int8Kernels() {
+        quantize = quantizeRowScalar;
+        gemm = gemmInt8Scalar;
+        gemmBlock = 1;
+        name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) {
+            quantize = quantizeRowAvx512;
+            gemm = gemmInt8Vnni;
+            gemmBlock = 16;
+            name = "avx512-vnni";
+        } else if (__builtin_cpu_supports("avx2")) {
+            quantize = quantizeRowAvx2;
+            gemm = gemmInt8Avx2;
+            gemmBlock = 8;
+            name = "avx2";
+        }
+#endif
+    }
+};
+
+const Int8Kernels int8Kernels;
+
+struct FastRng {
+    uint64_t state;
+
+    FastRng(uint64_t seed = 0x9E3779B97F4A7C15ULL) {
+        state = seed;
+    }
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    int below(int n) {
+        return (int)(((next() >> 32) * (uint64_t)n) >> 32);
+    }
+
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+struct ExecutorTask {
+    void (*run)(void*);
+    void* arg;
+};
+
+class WorkStealingExecutor {
+public:
+    WorkStealingExecutor(int threads = thread::hardware_concurrency()) : workers(max(1, threads)) {
+        stopping = false;
+        pending = 0;
+        sleeping = 0;
+        injected = 0;
+        for (int i = 0; i < (int)workers.size(); i++) pool.push_back(thread([this, i] { workerLoop(i); }));
+    }
+
+    ~WorkStealingExecutor() {
+        {
+            lock_guard<mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : pool) t.join();
+    }
+
+    int workerCount() const {
+        return (int)workers.size();
+    }
+
+    void schedule(ExecutorTask task) {
+        int id = owner == this ? index : (int)(injected++ % workers.size());
+        {
+            lock_guard<mutex> guard(workers[id].lock);
+            workers[id].tasks.push_back(task);
+        }
+        lock_guard<mutex> guard(sleepLock);
+        pending++;
+        if (sleeping > 0) wake.notify_one();
+    }
+
+    void schedule(coroutine_handle<> handle) {
+        schedule({ [](void* address) { coroutine_handle<>::from_address(address).resume(); }, handle.address() });
+    }
+
+    int currentWorker() const {
+        return owner == this ? index : -1;
+    }
+
+    bool runPending() {
+        int id = currentWorker();
+        ExecutorTask task;
+        FastRng& rng = helperRng();
+        if ((id >= 0 && popLocal(id, task)) || steal(id, rng, task)) {
+            pending--;
+            task.run(task.arg);
+            return true;
+        }
+        return false;
+    }
+
+    void complete(atomic<long long>& outstanding) {
+        lock_guard<mutex> guard(sleepLock);
+        if (--outstanding == 0) wake.notify_all();
+    }
+
+    void helpUntilDone(const atomic<long long>& outstanding) {
+        while (outstanding > 0) {
+            if (runPending()) continue;
+            unique_lock<mutex> lock(sleepLock);
+            sleeping++;
+            wake.wait(lock, [&] { return outstanding == 0 || pending > 0; });
+            sleeping--;
+        }
+    }
+
+private:
+    struct alignas(64) Worker {
+        mutex lock;
+        deque<ExecutorTask> tasks;
+    };
+
+    vector<Worker> workers;
+    vector<thread> pool;
+    atomic<bool> stopping;
+    atomic<long long> pending;
+    atomic<int> sleeping;
+    atomic<unsigned> injected;
+    mutex sleepLock;
+    condition_variable wake;
+    static inline thread_local WorkStealingExecutor* owner = nullptr;
+    static inline thread_local int index = -1;
+
+    static FastRng& helperRng() {
+        thread_local FastRng rng((uint64_t)hash<thread::id>()(this_thread::get_id()));
+        return rng;
+    }
+
+    bool popLocal(int id, ExecutorTask& task) {
+        lock_guard<mutex> guard(workers[id].lock);
+        if (workers[id].tasks.empty()) return false;
+        task = workers[id].tasks.back();
+        workers[id].tasks.pop_back();
+        return true;
+    }
+
+    bool steal(int id, FastRng& rng, ExecutorTask& task) {
+        int n = (int)workers.size();
+        int start = rng.below(n);
+        for (int k = 0; k < n; k++) {
+            int victim = (start + k) % n;
+            if (victim == id) continue;
+            lock_guard<mutex> guard(workers[victim].lock);
+            if (workers[victim].tasks.empty()) continue;
+            task = workers[victim].tasks.front();
+            workers[victim].tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(int id) {
+        owner = this;
+        index = id;
+        FastRng rng(0x9E3779B97F4A7C15ULL * (id + 1));
+        while (true) {
+            ExecutorTask task;
+            if (popLocal(id, task) || steal(id, rng, task)) {
+                pending--;
+                task.run(task.arg);
+                continue;
+            }
+            if (stopping && pending == 0) return;
+            unique_lock<mutex> lock(sleepLock);
+            sleeping++;
+            wake.wait(lock, [&] { return pending > 0 || stopping; });
+            sleeping--;
+        }
+    }
+};
+
+WorkStealingExecutor& sharedExecutor() {
+    static WorkStealingExecutor executor;
+    return executor;
+}
+
+class TaskGroup {
+public:
+    TaskGroup(WorkStealingExecutor& ex = sharedExecutor()) : executor(ex) {
+        pending = 0;
+    }
+
+    ~TaskGroup() {
+        executor.helpUntilDone(pending);
+    }
+
+    void run(function<void()> fn) {
+        pending++;
+        executor.schedule({ &TaskGroup::invoke, new Job{ this, std::move(fn) } });
+    }
+
+    void parallelFor(long long begin, long long end, long long grain, function<void(long long, long long)> body) {
+        if (begin >= end) return;
+        bodies.push_back(std::move(body));
+        RangeBody* shared = &bodies.back();
+        grain = max(1LL, grain);
+        run([=, this] { split(begin, end, grain, shared); });
+    }
+
+    bool done() const {
+        return pending == 0;
+    }
+
+    void wait() {
+        executor.helpUntilDone(pending);
+        exception_ptr failure;
+        {
+            lock_guard<mutex> guard(lock);
+            failure = error;
+            error = nullptr;
+        }
+        if (failure) rethrow_exception(failure);
+    }
+
+private:
+    typedef function<void(long long, long long)> RangeBody;
+
+    struct Job {
+        TaskGroup* group;
+        function<void()> fn;
+    };
+
+    WorkStealingExecutor& executor;
+    atomic<long long> pending;
+    deque<RangeBody> bodies;
+    mutex lock;
+    exception_ptr error;
+
+    static void invoke(void* arg) {
+        Job* job = (Job*)arg;
+        TaskGroup* group = job->group;
+        try {
+            job->fn();
+        } catch (...) {
+            lock_guard<mutex> guard(group->lock);
+            if (!group->error) group->error = current_exception();
+        }
+        delete job;
+        group->executor.complete(group->pending);
+    }
+
+    void split(long long begin, long long end, long long grain, RangeBody* body) {
+        while (end - begin > grain) {
+            long long mid = begin + (end - begin) / 2;
+            run([=, this] { split(mid, end, grain, body); });
+            end = mid;
+        }
+        (*body)(begin, end);
+    }
+};
+
+string checkTaskGroup() {
+    for (int threads : { 1, 4 }) {
+        WorkStealingExecutor executor(threads);
+        vector<atomic<int>> visits(100000);
+        for (auto& v : visits) v = 0;
+        TaskGroup group(executor);
+        group.parallelFor(0, (long long)visits.size(), 7, [&](long long first, long long last) {
+            TaskGroup inner(executor);
+            inner.parallelFor(first, last, 2, [&](long long a, long long b) {
+                for (long long i = a; i < b; i++) visits[i]++;
+            });
+            inner.wait();
+        });
+        group.wait();
+        for (int i = 0; i < (int)visits.size(); i++)
+            if (visits[i] != 1) return "index " + to_string(i) + " ran " + to_string(visits[i]) + " times with " + to_string(threads) + " workers";
+        atomic<int> ran(0);
+        group.parallelFor(0, 1000, 1, [&](long long first, long long) {
+            ran++;
+            if (first == 500) throw runtime_error("boom");
+        });
+        try {
+            group.wait();
+            return "exception was not rethrown from wait";
+        } catch (const runtime_error& e) {
+            if (string(e.what()) != "boom") return string("unexpected exception ") + e.what();
+        }
+        if (ran != 1000) return to_string(ran.load()) + " of 1000 tasks ran after a failure";
+        group.wait();
+    }
+    return "";
+}
+
+template <class T>
+class ObjectPool {
+public:
+    ObjectPool(function<unique_ptr<T>()> factory) : make(std::move(factory)) {}
+
+    unique_ptr<T> acquire() {
+        {
+            lock_guard<mutex> guard(lock);
+            if (!free.empty()) {
+                unique_ptr<T> item = std::move(free.back());
+                free.pop_back();
+                return item;
+            }
+        }
+        return make();
+    }
+
+    void release(unique_ptr<T> item) {
+        lock_guard<mutex> guard(lock);
+        free.push_back(std::move(item));
+    }
+
+private:
+    function<unique_ptr<T>()> make;
+    mutex lock;
+    vector<unique_ptr<T>> free;
+};
+
+template <class T>
+class MpmcQueue {
+public:
+    MpmcQueue(size_t capacity) : cells(new Cell[capacity]), mask(capacity - 1) {
+        for (size_t i = 0; i < capacity; i++) cells[i].sequence.store(i, memory_order_relaxed);
+        head.store(0, memory_order_relaxed);
+        tail.store(0, memory_order_relaxed);
+    }
+
+    bool push(const T& value) {
+        size_t pos = tail.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            intptr_t diff = (intptr_t)cell->sequence.load(memory_order_acquire) - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value) {
+        size_t pos = head.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            intptr_t diff = (intptr_t)cell->sequence.load(memory_order_acquire) - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(memory_order_relaxed);
+            }
+        }
+        value = cell->value;
+        cell->sequence.store(pos + mask + 1, memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+};
+
+string checkMpmcQueue() {
+    MpmcQueue<long long> small(8);
+    long long value;
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < 8; i++)
+            if (!small.push(round * 8 + i)) return "push failed below capacity";
+        if (small.push(-1)) return "push succeeded on a full queue";
+        for (int i = 0; i < 8; i++)
+            if (!small.pop(value) || value != round * 8 + i) return "pop returned values out of order";
+        if (small.pop(value)) return "pop succeeded on an empty queue";
+    }
+    const int producers = 4, consumers = 4;
+    const long long perProducer = 50000;
+    MpmcQueue<long long> queue(64);
+    vector<atomic<int>> seen(producers * perProducer);
+    for (auto& s : seen) s = 0;
+    atomic<long long> received(0);
+    atomic<bool> ordered(true);
+    vector<thread> pool;
+    for (int p = 0; p < producers; p++)
+        pool.push_back(thread([&, p] {
+            for (long long i = 0; i < perProducer; i++)
+                while (!queue.push(p * perProducer + i)) this_thread::yield();
+        }));
+    for (int c = 0; c < consumers; c++)
+        pool.push_back(thread([&] {
+            vector<long long> last(producers, -1);
+            long long v;
+            while (received < producers * perProducer) {
+                if (!queue.pop(v)) {
+                    this_thread::yield();
+                    continue;
+                }
+                if (v < last[v / perProducer]) ordered = false;
+                last[v / perProducer] = v;
+                seen[v]++;
+                received++;
+            }
+        }));
+    for (auto& t : pool) t.join();
+    if (!ordered) return "a consumer saw one producer's values out of order";
+    for (long long i = 0; i < (long long)seen.size(); i++)
+        if (seen[i] != 1) return "value " + to_string(i) + " was popped " + to_string(seen[i]) + " times";
+    return "";
+}
+
+class FramePool {
+public:
+    static const int CLASS_BYTES = 64;
+    static const int CLASSES = 64;
+    static const int CACHED_PER_CLASS = 4096;
+
+    static void* allocate(size_t size) {
+        size_t cls = (size - 1) / CLASS_BYTES;
+        if (cls >= CLASSES) return ::operator new(size);
+        Cache& c = cache();
+        if (Node* n = c.free[cls]) {
+            c.free[cls] = n->next;
+            c.count[cls]--;
+            return n;
+        }
+        return ::operator new((cls + 1) * CLASS_BYTES);
+    }
+
+    static void release(void* p, size_t size) {
+        size_t cls = (size - 1) / CLASS_BYTES;
+        if (cls >= CLASSES) {
+            ::operator delete(p);
+            return;
+        }
+        Cache& c = cache();
+        if (c.count[cls] >= CACHED_PER_CLASS) {
+            ::operator delete(p);
+            return;
+        }
+        Node* n = (Node*)p;
+        n->next = c.free[cls];
+        c.free[cls] = n;
+        c.count[cls]++;
+    }
+
+private:
+    struct Node {
+        Node* next;
+    };
+
+    struct Cache {
+        Node* free[CLASSES] = {};
+        int count[CLASSES] = {};
+
+        ~Cache() {
+            for (int i = 0; i < CLASSES; i++)
+                while (Node* n = free[i]) {
+                    free[i] = n->next;
+                    ::operator delete(n);
+                }
+        }
+    };
+
+    static Cache& cache() {
+        thread_local Cache c;
+        return c;
+    }
+};
+
 class Deck {
 public:
     vector<Card> cards;
     stack<Card> pile;
 
-    Deck() {
-        generate();
-        shuffle();
+    Deck() {
+        generate();
+        shuffle();
+    }
+
+    void generate() {
+        cards.clear();
+        for (int c = RED; c <= YELLOW; c++) {
+            for (int n = 0; n <= 9; n++)
+                cards.push_back(Card((Color)c, NUMBER, n));
+            for (int t = SKIP; t <= DRAW_TWO; t++)
+                cards.push_back(Card((Color)c, (Type)t));
+        }
+        for (int i = 0; i < 4; i++) {
+            cards.push_back(Card(NONE, WILD));
+            cards.push_back(Card(NONE, WILD_DRAW_FOUR));
+        }
+    }
+
+    void shuffle() {
+        srand(time(0));
+        for (int i = 0; i < (int)cards.size(); i++) {
+            int j = rand() % cards.size();
+            swap(cards[i], cards[j]);
+        }
+    }
+
+    Card drawCard() {
+        if (cards.empty()) generate();
+        Card c = cards.back();
+        cards.pop_back();
+        return c;
+    }
+
+    void placeCard(Card c) {
+        pile.push(c);
+    }
+
+    Card topCard() {
+        return pile.top();
+    }
+};
+
+class BotPolicy;
+
+class Player {
+public:
+    vector<Card> hand;
+    string name;
+    bool isBot;
+    BotPolicy* policy;
+    alignas(64) uint8_t counts[KIND_LANES];
+
+    Player(string n, bool bot = false, BotPolicy* botPolicy = nullptr) {
+        name = n;
+        isBot = bot;
+        policy = botPolicy;
+        memset(counts, 0, sizeof(counts));
+    }
+
+    void addCard(Card c) {
+        hand.push_back(c);
+        counts[cardKind(c)]++;
+    }
+
+    Card removeAt(int i) {
+        Card c = hand[i];
+        hand.erase(hand.begin() + i);
+        counts[cardKind(c)]--;
+        return c;
+    }
+
+    void draw(Deck& deck, int count = 1) {
+        for (int i = 0; i < count; i++)
+            addCard(deck.drawCard());
+    }
+
+    bool canPlay(Card c, Card top, Color currentColor) {
+        return canPlayOn(c, top, currentColor);
+    }
+
+    bool hasPlayableCard(Card top, Color currentColor) {
+        return hasPlayable(counts, kindTable.playable[cardKind(top)][currentColor]);
+    }
+
+    Card takeKind(int kind) {
+        if (counts[kind] == 0) return Card(NONE, NUMBER);
+        for (int i = 0; i < (int)hand.size(); i++)
+            if (cardKind(hand[i]) == kind) return removeAt(i);
+        return Card(NONE, NUMBER);
+    }
+};
+
+struct SnapshotWriter {
+    vector<uint8_t> bytes;
+
+    void u8(int v) {
+        bytes.push_back((uint8_t)v);
+    }
+
+    void u16(int v) {
+        u8(v & 255);
+        u8(v >> 8 & 255);
+    }
+
+    void u32(uint32_t v) {
+        u16(v & 0xFFFF);
+        u16(v >> 16);
+    }
+
+    void u64(uint64_t v) {
+        u32((uint32_t)v);
+        u32((uint32_t)(v >> 32));
+    }
+
+    void counts(const uint8_t* c) {
+        uint64_t mask = nonzeroLanesScalar(c);
+        u64(mask);
+        for (; mask; mask &= mask - 1) u8(c[__builtin_ctzll(mask)]);
+    }
+};
+
+struct SnapshotReader {
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool ok;
+
+    SnapshotReader(const uint8_t* data, size_t size) {
+        pos = data;
+        end = data + size;
+        ok = true;
+    }
+
+    int u8() {
+        if (pos >= end) {
+            ok = false;
+            return 0;
+        }
+        return *pos++;
+    }
+
+    int u16() {
+        int lo = u8();
+        return lo | u8() << 8;
+    }
+
+    uint32_t u32() {
+        uint32_t lo = u16();
+        return lo | (uint32_t)u16() << 16;
+    }
+
+    uint64_t u64() {
+        uint64_t lo = u32();
+        return lo | (uint64_t)u32() << 32;
+    }
+
+    void counts(uint8_t* c) {
+        memset(c, 0, KIND_LANES);
+        uint64_t mask = u64();
+        if (mask >> NUM_KINDS) ok = false;
+        for (; mask && ok; mask &= mask - 1) c[__builtin_ctzll(mask)] = u8();
+    }
+};
+
+inline uint64_t hashMix(uint64_t h, uint64_t word) {
+    h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 32);
+}
+
+struct GameState {
+    alignas(64) uint8_t hands[4][KIND_LANES];
+    alignas(64) uint8_t deck[KIND_LANES];
+    alignas(64) uint8_t discarded[KIND_LANES];
+    int handSize[4];
+    int deckSize;
+    int topKind;
+    Color currentColor;
+    int currentPlayer;
+    int direction;
+    int pendingPenalty;
+    Type pendingType;
+    int drawsOwed;
+    bool voluntaryDraw;
+    int drawnKind;
+    bool allDiscardRule;
+    bool drawThenPlayRule;
+    int winner;
+    int turns;
+
+    GameState() {
+        memset(hands, 0, sizeof(hands));
+        memset(deck, 0, sizeof(deck));
+        memset(discarded, 0, sizeof(discarded));
+        for (int i = 0; i < 4; i++) handSize[i] = 0;
+        deckSize = 0;
+        topKind = 0;
+        currentColor = RED;
+        currentPlayer = 0;
+        direction = 1;
+        pendingPenalty = 0;
+        pendingType = NUMBER;
+        drawsOwed = 0;
+        voluntaryDraw = false;
+        drawnKind = -1;
+        allDiscardRule = false;
+        drawThenPlayRule = false;
+        winner = -1;
+        turns = 0;
+    }
+
+    static GameState deal(uint64_t seed, bool allDiscard, bool drawThenPlay = false) {
+        GameState s;
+        FastRng rng(seed);
+        s.allDiscardRule = allDiscard;
+        s.drawThenPlayRule = drawThenPlay;
+        s.refillDeck();
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 7; j++)
+                s.give(i, s.takeFromDeck(s.sampleDeck(rng)));
+        int first = s.takeFromDeck(s.sampleDeck(rng));
+        while (first == KIND_WILD_DRAW_FOUR) {
+            s.discarded[first]++;
+            first = s.takeFromDeck(s.sampleDeck(rng));
+        }
+        s.topKind = first;
+        s.discarded[first]++;
+        s.currentColor = first == KIND_WILD ? (Color)rng.below(4) : kindTable.color[first];
+        return s;
+    }
+
+    void refillDeck() {
+        for (int k = 0; k < NUM_KINDS; k++) deck[k] = kindTable.copies[k];
+        deckSize = FULL_DECK_SIZE;
+    }
+
+    int sampleDeck(FastRng& rng) {
+        if (deckSize == 0) refillDeck();
+        return handKernels.nthCard(deck, rng.below(deckSize));
+    }
+
+    int takeFromDeck(int kind) {
+        deck[kind]--;
+        deckSize--;
+        return kind;
+    }
+
+    void give(int seat, int kind) {
+        hands[seat][kind]++;
+        handSize[seat]++;
+    }
+
+    int totalCards() const {
+        return handSize[0] + handSize[1] + handSize[2] + handSize[3];
+    }
+
+    int nextSeat(int seat) const {
+        return (seat + direction + 4) % 4;
+    }
+
+    void advanceTurn() {
+        currentPlayer = nextSeat(currentPlayer);
+    }
+
+    uint64_t handMask(int seat) const {
+        return handKernels.nonzeroLanes(hands[seat]);
+    }
+
+    int colorCount(int seat, Color c) const {
+        int counts[4];
+        handKernels.colorCounts(hands[seat], counts);
+        return counts[c];
+    }
+
+    uint64_t legalMask() const {
+        if (drawnKind >= 0) return 1ULL << drawnKind;
+        uint64_t mask = handMask(currentPlayer);
+        if (pendingPenalty == 0) return mask & kindTable.playable[topKind][currentColor];
+        if (pendingType == WILD_DRAW_FOUR) return mask & (1ULL << KIND_WILD_DRAW_FOUR);
+        return mask & (1ULL << (kindTable.color[topKind] * 13 + 12));
+    }
+
+    void play(int kind, Color chosen) {
+        int seat = currentPlayer;
+        bool stacking = pendingPenalty > 0;
+        drawnKind = -1;
+        hands[seat][kind]--;
+        handSize[seat]--;
+        topKind = kind;
+        discarded[kind]++;
+        Color played = kindTable.color[kind];
+        currentColor = played == NONE ? chosen : played;
+        if (allDiscardRule && !stacking) {
+            for (int k = 0; k < NUM_KINDS; k++)
+                if (kindTable.color[k] == played && hands[seat][k]) {
+                    handSize[seat] -= hands[seat][k];
+                    discarded[k] += hands[seat][k];
+                    hands[seat][k] = 0;
+                }
+        }
+        turns++;
+        if (handSize[seat] == 0) {
+            winner = seat;
+            return;
+        }
+        Type t = kindTable.type[kind];
+        if (t == REVERSE) direction = -direction;
+        else if (t == SKIP) advanceTurn();
+        else if (t == DRAW_TWO || t == WILD_DRAW_FOUR) {
+            pendingPenalty += t == DRAW_TWO ? 2 : 4;
+            pendingType = t;
+        }
+        advanceTurn();
+    }
+
+    void draw() {
+        if (drawnKind >= 0) {
+            drawnKind = -1;
+            advanceTurn();
+            return;
+        }
+        voluntaryDraw = pendingPenalty == 0;
+        drawsOwed = voluntaryDraw ? 1 : pendingPenalty;
+        pendingPenalty = 0;
+        turns++;
+    }
+
+    void resolveDraw(int kind) {
+        if (deckSize == 0) refillDeck();
+        give(currentPlayer, takeFromDeck(kind));
+        if (--drawsOwed > 0) return;
+        if (voluntaryDraw && drawThenPlayRule && (kindTable.playable[topKind][currentColor] >> kind & 1)) drawnKind = kind;
+        else advanceTurn();
+    }
+
+    void resolveDraws(FastRng& rng) {
+        while (drawsOwed > 0) resolveDraw(sampleDeck(rng));
+    }
+
+    void save(SnapshotWriter& w) const {
+        for (int i = 0; i < 4; i++) w.counts(hands[i]);
+        w.counts(deck);
+        w.counts(discarded);
+        w.u8(topKind);
+        w.u8(currentColor);
+        w.u8(currentPlayer);
+        w.u8(direction > 0);
+        w.u16(pendingPenalty);
+        w.u8(pendingType);
+        w.u16(drawsOwed);
+        w.u8(drawnKind + 1);
+        w.u8(winner + 1);
+        w.u8(voluntaryDraw | allDiscardRule << 1 | drawThenPlayRule << 2);
+        w.u32(turns);
+    }
+
+    bool load(SnapshotReader& r) {
+        for (int i = 0; i < 4; i++) r.counts(hands[i]);
+        r.counts(deck);
+        r.counts(discarded);
+        topKind = r.u8();
+        currentColor = (Color)r.u8();
+        currentPlayer = r.u8();
+        direction = r.u8() ? 1 : -1;
+        pendingPenalty = r.u16();
+        pendingType = (Type)r.u8();
+        drawsOwed = r.u16();
+        drawnKind = r.u8() - 1;
+        winner = r.u8() - 1;
+        int flags = r.u8();
+        voluntaryDraw = flags & 1;
+        allDiscardRule = flags & 2;
+        drawThenPlayRule = flags & 4;
+        turns = r.u32();
+        deckSize = 0;
+        for (int k = 0; k < NUM_KINDS; k++) deckSize += deck[k];
+        for (int i = 0; i < 4; i++) {
+            handSize[i] = 0;
+            for (int k = 0; k < NUM_KINDS; k++) handSize[i] += hands[i][k];
+        }
+        return r.ok && topKind < NUM_KINDS && currentColor <= NONE && currentPlayer < 4 && pendingType <= WILD_DRAW_FOUR
+            && drawnKind < NUM_KINDS && winner < 4;
+    }
+
+    uint64_t hash() const {
+        const uint64_t* words = (const uint64_t*)hands;
+        uint64_t h = 0x84222325CBF29CE4ULL;
+        for (int i = 0; i < (int)(sizeof(hands) / 8); i++) h = hashMix(h, words[i]);
+        words = (const uint64_t*)deck;
+        for (int i = 0; i < (int)(sizeof(deck) / 8); i++) h = hashMix(h, words[i]);
+        uint64_t tail = (uint64_t)topKind | (uint64_t)currentColor << 8 | (uint64_t)currentPlayer << 12
+            | (uint64_t)(direction + 1) << 16 | (uint64_t)pendingPenalty << 20 | (uint64_t)pendingType << 28
+            | (uint64_t)drawsOwed << 32 | (uint64_t)allDiscardRule << 40;
+        h = hashMix(h, tail);
+        tail = (uint64_t)(drawnKind + 1) | (uint64_t)voluntaryDraw << 8 | (uint64_t)drawThenPlayRule << 9;
+        return hashMix(h, tail);
+    }
+};
+
+struct EndgameResult {
+    double winProb[4];
+    int bestKind;
+    Color bestColor;
+    bool exact;
+    double slack;
+    long long nodes;
+};
+
+const int ENDGAME_CARDS = 10;
+const int ENDGAME_DRAWS = 2;
+const double ENDGAME_MAX_SLACK = 0.25;
+
+class EndgameSolver {
+public:
+    int threshold;
+    int maxDraws;
+
+    EndgameSolver(int cardThreshold = ENDGAME_CARDS, int draws = ENDGAME_DRAWS, int tableBits = 16) {
+        threshold = cardThreshold;
+        maxDraws = draws;
+        table.resize(1ULL << tableBits);
+        clear();
+    }
+
+    bool applies(const GameState& s) const {
+        return s.winner < 0 && s.drawsOwed == 0 && s.totalCards() <= threshold;
+    }
+
+    void clear() {
+        for (auto& e : table) e.key = 0;
+    }
+
+    EndgameResult solve(const GameState& s) {
+        EndgameResult r;
+        nodes = 0;
+        int kind = DRAW_MOVE;
+        Color color = NONE;
+        Value v = search(s, maxDraws, kind, color);
+        for (int i = 0; i < 4; i++) r.winProb[i] = v.p[i];
+        r.bestKind = kind;
+        r.bestColor = kind == DRAW_MOVE ? NONE : (kindTable.isWild(kind) ? color : kindTable.color[kind]);
+        r.exact = v.exact;
+        r.slack = v.slack;
+        r.nodes = nodes;
+        return r;
+    }
+
+private:
+    struct Value {
+        double p[4];
+        double slack;
+        bool exact;
+    };
+
+    struct Entry {
+        uint64_t key;
+        double p[4];
+        double slack;
+        int8_t bestKind;
+        int8_t bestColor;
+        uint8_t draws;
+        bool exact;
+    };
+
+    vector<Entry> table;
+    long long nodes;
+
+    Value leaf(const GameState& s) {
+        Value v;
+        double total = 0;
+        for (int i = 0; i < 4; i++) {
+            v.p[i] = 1.0 / ((double)s.handSize[i] * s.handSize[i]);
+            total += v.p[i];
+        }
+        for (int i = 0; i < 4; i++) v.p[i] /= total;
+        v.slack = 1;
+        v.exact = false;
+        return v;
+    }
+
+    Value chance(const GameState& s, int draws) {
+        if (draws <= 0) return leaf(s);
+        GameState base = s;
+        if (base.deckSize == 0) base.refillDeck();
+        Value v = { {0, 0, 0, 0}, 0, true };
+        int ignoreKind;
+        Color ignoreColor;
+        for (int k = 0; k < NUM_KINDS; k++) {
+            if (!base.deck[k]) continue;
+            double w = (double)base.deck[k] / base.deckSize;
+            GameState child = base;
+            child.resolveDraw(k);
+            Value c = search(child, draws - 1, ignoreKind, ignoreColor);
+            for (int i = 0; i < 4; i++) v.p[i] += w * c.p[i];
+            v.slack += w * c.slack;
+            v.exact = v.exact && c.exact;
+        }
+        return v;
+    }
+
+    Value search(const GameState& s, int draws, int& bestKind, Color& bestColor) {
+        nodes++;
+        if (s.winner >= 0) {
+            Value v = { {0, 0, 0, 0}, 0, true };
+            v.p[s.winner] = 1;
+            return v;
+        }
+        if (s.drawsOwed > 0) return chance(s, draws);
+
+        uint64_t key = s.hash() | 1;
+        Entry& e = table[key & (table.size() - 1)];
+        if (e.key == key && (e.exact ? e.draws <= draws : e.draws == draws)) {
+            Value v;
+            for (int i = 0; i < 4; i++) v.p[i] = e.p[i];
+            v.slack = e.slack;
+            v.exact = e.exact;
+            bestKind = e.bestKind;
+            bestColor = (Color)e.bestColor;
+            return v;
+        }
+
+        int seat = s.currentPlayer;
+        uint64_t legal = s.legalMask();
+        Value best = { {-1, -1, -1, -1}, 0, true };
+        bool allExact = true;
+        bestKind = DRAW_MOVE;
+        bestColor = NONE;
+        int childKind;
+        Color childColor;
+        for (uint64_t m = legal; m; m &= m - 1) {
+            int k = __builtin_ctzll(m);
+            int colors = kindTable.isWild(k) ? 4 : 1;
+            for (int c = 0; c < colors; c++) {
+                GameState child = s;
+                child.play(k, (Color)c);
+                Value v = search(child, draws, childKind, childColor);
+                allExact = allExact && v.exact;
+                if (v.p[seat] > best.p[seat]) {
+                    best = v;
+                    bestKind = k;
+                    bestColor = (Color)c;
+                }
+            }
+        }
+        if (!legal || s.pendingPenalty > 0 || s.drawnKind >= 0) {
+            GameState child = s;
+            child.draw();
+            Value v = search(child, draws, childKind, childColor);
+            allExact = allExact && v.exact;
+            if (v.p[seat] > best.p[seat]) {
+                best = v;
+                bestKind = DRAW_MOVE;
+                bestColor = NONE;
+            }
+        }
+
+        best.exact = allExact;
+
+        e.key = key;
+        for (int i = 0; i < 4; i++) e.p[i] = best.p[i];
+        e.slack = best.slack;
+        e.exact = best.exact;
+        e.bestKind = (int8_t)bestKind;
+        e.bestColor = (int8_t)bestColor;
+        e.draws = (uint8_t)draws;
+        return best;
+    }
+};
+
+class CardTracker {
+public:
+    int seat;
+    int16_t unseen[KIND_LANES];
+    int unseenTotal;
+    int colorUnseen[5];
+    uint64_t absent[4];
+    int drawnSince[4];
+    int absentUnseen[4][5];
+    int turns;
+
+    CardTracker(int trackedSeat = 0) {
+        seat = trackedSeat;
+        memset(unseen, 0, sizeof(unseen));
+        memset(colorUnseen, 0, sizeof(colorUnseen));
+        memset(absent, 0, sizeof(absent));
+        memset(drawnSince, 0, sizeof(drawnSince));
+        memset(absentUnseen, 0, sizeof(absentUnseen));
+        unseenTotal = 0;
+        turns = -1;
+    }
+
+    bool synced(const GameState& s) const {
+        return turns == s.turns;
+    }
+
+    void reset(const GameState& s) {
+        int discardedTotal = 0;
+        for (int k = 0; k < NUM_KINDS; k++) discardedTotal += s.discarded[k];
+        int decks = (discardedTotal + s.totalCards() + s.deckSize + FULL_DECK_SIZE - 1) / FULL_DECK_SIZE;
+        memset(unseen, 0, sizeof(unseen));
+        memset(colorUnseen, 0, sizeof(colorUnseen));
+        unseenTotal = 0;
+        for (int k = 0; k < NUM_KINDS; k++) {
+            unseen[k] = (int16_t)max(0, kindTable.copies[k] * decks - s.discarded[k] - s.hands[seat][k]);
+            colorUnseen[kindTable.color[k]] += unseen[k];
+            unseenTotal += unseen[k];
+        }
+        for (int i = 0; i < 4; i++) setAbsent(i, 0);
+        turns = s.turns;
+    }
+
+    void observe(const GameState& before, const GameState& after, int actor, int kind) {
+        if (!synced(before)) {
+            reset(after);
+            return;
+        }
+        if (after.deckSize > before.deckSize) addDeck();
+        if (kind != DRAW_MOVE) {
+            if (actor != seat) {
+                remove(kind, 1);
+                if ((absent[actor] >> kind & 1) && drawnSince[actor] > 0) drawnSince[actor]--;
+                if (before.allDiscardRule && before.pendingPenalty == 0) {
+                    Color played = kindTable.color[kind];
+                    int first = played == NONE ? KIND_WILD : played * 13;
+                    int last = played == NONE ? NUM_KINDS : first + 13;
+                    for (int k = first; k < last; k++) {
+                        int extra = after.discarded[k] - before.discarded[k] - (k == kind);
+                        if (extra > 0) remove(k, extra);
+                    }
+                }
+            }
+        } else if (before.drawnKind < 0) {
+            if (actor == seat) {
+                for (int k = 0; k < NUM_KINDS; k++)
+                    if (after.hands[seat][k] > before.hands[seat][k]) remove(k, after.hands[seat][k] - before.hands[seat][k]);
+            } else {
+                if (before.pendingPenalty == 0) setAbsent(actor, kindTable.playable[before.topKind][before.currentColor]);
+                drawnSince[actor] += after.handSize[actor] - before.handSize[actor];
+            }
+        }
+        turns = after.turns;
+    }
+
+    double kindProbability(int kind) const {
+        return unseenTotal > 0 ? (double)unseen[kind] / unseenTotal : 0;
+    }
+
+    double holdsProbability(const GameState& s, int opponent, int kind) const {
+        return 1 - missProbability(s, opponent, unseen[kind], (absent[opponent] >> kind & 1) ? unseen[kind] : 0);
+    }
+
+    double colorVoidProbability(const GameState& s, int opponent, Color c) const {
+        return missProbability(s, opponent, colorUnseen[c], absentUnseen[opponent][c]);
+    }
+
+private:
+    void remove(int kind, int n) {
+        Color c = kindTable.color[kind];
+        unseen[kind] -= n;
+        unseenTotal -= n;
+        colorUnseen[c] -= n;
+        for (int i = 0; i < 4; i++)
+            if (absent[i] >> kind & 1) absentUnseen[i][c] -= n;
+    }
+
+    void addDeck() {
+        for (int k = 0; k < NUM_KINDS; k++) {
+            unseen[k] += kindTable.copies[k];
+            colorUnseen[kindTable.color[k]] += kindTable.copies[k];
+        }
+        unseenTotal += FULL_DECK_SIZE;
+        for (int i = 0; i < 4; i++) setAbsent(i, absent[i], drawnSince[i]);
+    }
+
+    void setAbsent(int opponent, uint64_t mask, int drawn = 0) {
+        absent[opponent] = mask;
+        drawnSince[opponent] = drawn;
+        memset(absentUnseen[opponent], 0, sizeof(absentUnseen[opponent]));
+        for (uint64_t m = mask; m; m &= m - 1) {
+            int k = __builtin_ctzll(m);
+            absentUnseen[opponent][kindTable.color[k]] += unseen[k];
+        }
+    }
+
+    double missProbability(const GameState& s, int opponent, int matching, int excluded) const {
+        if (unseenTotal <= 0) return 1;
+        int free = min(drawnSince[opponent], s.handSize[opponent]);
+        int constrained = s.handSize[opponent] - free;
+        int allowed = unseenTotal;
+        for (int c = 0; c < 5; c++) allowed -= absentUnseen[opponent][c];
+        double pFree = (double)matching / unseenTotal;
+        double pConstrained = allowed > 0 ? (double)(matching - excluded) / allowed : 0;
+        return pow(1 - pConstrained, constrained) * pow(1 - pFree, free);
+    }
+};
+
+struct BinomialTable {
+    static const int MAX = 256;
+    vector<double> table;
+
+    BinomialTable() : table((MAX + 1) * (MAX + 1), 0.0) {
+        for (int n = 0; n <= MAX; n++) {
+            table[n * (MAX + 1)] = 1;
+            for (int k = 1; k <= n; k++) table[n * (MAX + 1) + k] = table[(n - 1) * (MAX + 1) + k - 1] + table[(n - 1) * (MAX + 1) + k];
+        }
+    }
+
+    double operator()(int n, int k) const {
+        if (k < 0 || n < 0 || k > n) return 0;
+        if (n <= MAX) return table[n * (MAX + 1) + k];
+        return exp(lgamma(n + 1.0) - lgamma(k + 1.0) - lgamma(n - k + 1.0));
+    }
+};
+
+const BinomialTable binomials;
+
+class DeterminizationSampler {
+public:
+    bool prepare(const CardTracker& t, const GameState& view) {
+        base = view;
+        memset(base.deck, 0, sizeof(base.deck));
+        base.deckSize = 0;
+        int n = 0;
+        for (int i = 0; i < 4; i++)
+            if (i != t.seat) {
+                opponents[n] = i;
+                memset(base.hands[i], 0, KIND_LANES);
+                base.handSize[i] = 0;
+                free[n] = min(t.drawnSince[i], view.handSize[i]);
+                constrained[n] = t.absent[i] ? view.handSize[i] - free[n] : 0;
+                free[n] = view.handSize[i] - constrained[n];
+                n++;
+            }
+        for (int c = 0; c < 8; c++) classCards[c].clear();
+        int dealt = 0;
+        for (int k = 0; k < NUM_KINDS; k++) {
+            int cls = 0;
+            for (int j = 0; j < 3; j++)
+                if (constrained[j] && (t.absent[opponents[j]] >> k & 1)) cls |= 1 << j;
+            classCards[cls].insert(classCards[cls].end(), t.unseen[k], (uint8_t)k);
+            dealt += t.unseen[k];
+        }
+        for (int j = 0; j < 3; j++) dealt -= view.handSize[opponents[j]];
+        if (dealt < 0) return false;
+        if (buildSplits()) return true;
+        for (int c = 1; c < 8; c++) {
+            classCards[0].insert(classCards[0].end(), classCards[c].begin(), classCards[c].end());
+            classCards[c].clear();
+        }
+        for (int j = 0; j < 3; j++) {
+            free[j] += constrained[j];
+            constrained[j] = 0;
+        }
+        return buildSplits();
+    }
+
+    void sample(FastRng& rng, GameState& out) {
+        out = base;
+        for (int c = 0; c < 8; c++) {
+            left[c] = (int)classCards[c].size();
+            memcpy(work[c], classCards[c].data(), left[c]);
+        }
+        double u = rng.uniform() * splits.back().cumulative;
+        const Split& split = *upper_bound(splits.begin(), splits.end(), u, [](double v, const Split& sp) { return v < sp.cumulative; });
+        for (int g = 0; g < 4; g++) take(rng, 1 << (g * 2), split.take[g], &out, opponents[0]);
+
+        int shared = left[0] + left[1], only1 = left[4] + left[5], only2 = left[2] + left[3];
+        double total = 0;
+        for (int k = 0; k <= constrained[1]; k++) total += secondWeight(shared, only1, only2, k);
+        double r = rng.uniform() * total;
+        int k = 0;
+        for (; k < constrained[1]; k++) {
+            r -= secondWeight(shared, only1, only2, k);
+            if (r < 0) break;
+        }
+        take(rng, 0x03, k, &out, opponents[1]);
+        take(rng, 0x30, constrained[1] - k, &out, opponents[1]);
+        take(rng, 0x0F, constrained[2], &out, opponents[2]);
+        for (int j = 0; j < 3; j++) take(rng, 0xFF, free[j], &out, opponents[j]);
+        for (int c = 0; c < 8; c++)
+            for (int i = 0; i < left[c]; i++) out.deck[work[c][i]]++;
+        for (int c = 0; c < 8; c++) out.deckSize += left[c];
+    }
+
+    void sampleBatch(FastRng& rng, GameState* arena, int count) {
+        for (int i = 0; i < count; i++) sample(rng, arena[i]);
+    }
+
+private:
+    struct Split {
+        double cumulative;
+        int take[4];
+    };
+
+    GameState base;
+    int opponents[3];
+    int constrained[3];
+    int free[3];
+    vector<uint8_t> classCards[8];
+    vector<Split> splits;
+    uint8_t work[8][BinomialTable::MAX];
+    int left[8];
+
+    double secondWeight(int shared, int only1, int only2, int k) const {
+        return binomials(shared, k) * binomials(only1, constrained[1] - k) * binomials(shared - k + only2, constrained[2]);
+    }
+
+    bool buildSplits() {
+        for (int c = 0; c < 8; c++)
+            if (classCards[c].size() > BinomialTable::MAX) return false;
+        splits.clear();
+        int n[8];
+        for (int c = 0; c < 8; c++) n[c] = (int)classCards[c].size();
+        double cumulative = 0;
+        int a = constrained[0];
+        for (int t0 = 0; t0 <= min(a, n[0]); t0++)
+            for (int t1 = 0; t1 <= min(a - t0, n[2]); t1++)
+                for (int t2 = 0; t2 <= min(a - t0 - t1, n[4]); t2++) {
+                    int t3 = a - t0 - t1 - t2;
+                    if (t3 > n[6]) continue;
+                    int shared = n[0] + n[1] - t0, only1 = n[4] + n[5] - t2, only2 = n[2] + n[3] - t1;
+                    double rest = 0;
+                    for (int k = 0; k <= constrained[1]; k++) rest += secondWeight(shared, only1, only2, k);
+                    double w = binomials(n[0], t0) * binomials(n[2], t1) * binomials(n[4], t2) * binomials(n[6], t3) * rest;
+                    if (w <= 0) continue;
+                    cumulative += w;
+                    splits.push_back({ cumulative, { t0, t1, t2, t3 } });
+                }
+        return !splits.empty();
+    }
+
+    void take(FastRng& rng, int classMask, int count, GameState* out, int seat) {
+        int available = 0;
+        for (int c = 0; c < 8; c++)
+            if (classMask >> c & 1) available += left[c];
+        for (; count > 0 && available > 0; count--, available--) {
+            int r = rng.below(available);
+            int c = 0;
+            while (!(classMask >> c & 1) || r >= left[c]) {
+                if (classMask >> c & 1) r -= left[c];
+                c++;
+            }
+            out->give(seat, work[c][r]);
+            work[c][r] = work[c][--left[c]];
+        }
+    }
+};
+
+string checkDeterminizationSampler() {
+    const int kinds[4] = { 1, 14, 40, 27 };
+    const int copies[4] = { 2, 2, 2, 2 };
+    const int sizes[4] = { 0, 2, 2, 2 };
+    CardTracker t(0);
+    for (int j = 0; j < 4; j++) {
+        t.unseen[kinds[j]] = copies[j];
+        t.unseenTotal += copies[j];
+    }
+    t.absent[1] = 1ULL << kinds[0];
+    t.drawnSince[1] = 1;
+    t.absent[2] = 1ULL << kinds[1];
+    t.absent[3] = 1ULL << kinds[0] | 1ULL << kinds[2];
+    GameState view;
+    for (int i = 1; i < 4; i++) view.handSize[i] = sizes[i];
+    int capacity[7], allowed[7];
+    for (int i = 1; i < 4; i++) {
+        int free = min(t.drawnSince[i], sizes[i]);
+        capacity[2 * i - 2] = sizes[i] - free;
+        capacity[2 * i - 1] = free;
+        allowed[2 * i - 2] = 0;
+        for (int j = 0; j < 4; j++)
+            if (!(t.absent[i] >> kinds[j] & 1)) allowed[2 * i - 2] |= 1 << j;
+        allowed[2 * i - 1] = 15;
+    }
+    vector<int> cards;
+    for (int j = 0; j < 4; j++) cards.insert(cards.end(), copies[j], j);
+    capacity[6] = (int)cards.size() - sizes[1] - sizes[2] - sizes[3];
+    allowed[6] = 15;
+    vector<double> exact(531441, 0);
+    int held[3][4] = {};
+    double deals = 0;
+    function<void(int)> enumerate = [&](int c) {
+        if (c == (int)cards.size()) {
+            int key = 0;
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 4; j++) key = key * 3 + held[i][j];
+            exact[key]++;
+            deals++;
+            return;
+        }
+        for (int d = 0; d < 7; d++)
+            if (capacity[d] > 0 && (allowed[d] >> cards[c] & 1)) {
+                capacity[d]--;
+                if (d < 6) held[d / 2][cards[c]]++;
+                enumerate(c + 1);
+                if (d < 6) held[d / 2][cards[c]]--;
+                capacity[d]++;
+            }
+    };
+    enumerate(0);
+    DeterminizationSampler sampler;
+    if (!sampler.prepare(t, view)) return "sampler rejected a satisfiable position";
+    FastRng rng(7);
+    const int samples = 200000;
+    vector<double> seen(exact.size(), 0);
+    GameState deal;
+    for (int n = 0; n < samples; n++) {
+        sampler.sample(rng, deal);
+        int key = 0;
+        for (int i = 1; i < 4; i++) {
+            if (deal.handSize[i] != sizes[i]) return "seat " + to_string(i) + " was dealt " + to_string(deal.handSize[i]) + " cards";
+            for (int j = 0; j < 4; j++) key = key * 3 + deal.hands[i][kinds[j]];
+        }
+        if (deal.deckSize != capacity[6]) return "deck holds " + to_string(deal.deckSize) + " cards";
+        if (exact[key] == 0) return "sampled a deal that breaks a void";
+        seen[key]++;
+    }
+    for (int key = 0; key < (int)exact.size(); key++)
+        if (fabs(seen[key] / samples - exact[key] / deals) > 0.005)
+            return "deal " + to_string(key) + " sampled at " + to_string(seen[key] / samples) + ", exact " + to_string(exact[key] / deals);
+    return "";
+}
+
+const int NUM_ACTIONS = 61;
+const int ACTION_DRAW = 60;
+
+int actionToKind(int action) {
+    if (action < 52) return action;
+    if (action < 56) return KIND_WILD;
+    if (action < 60) return KIND_WILD_DRAW_FOUR;
+    return DRAW_MOVE;
+}
+
+uint64_t legalActions(const GameState& s, uint64_t legal) {
+    uint64_t actions = legal & ((1ULL << 52) - 1);
+    if (legal >> KIND_WILD & 1) actions |= 0xFULL << 52;
+    if (legal >> KIND_WILD_DRAW_FOUR & 1) actions |= 0xFULL << 56;
+    if (!legal || s.pendingPenalty > 0 || s.drawnKind >= 0) actions |= 1ULL << ACTION_DRAW;
+    return actions;
+}
+
+uint64_t legalActions(const GameState& s) {
+    return legalActions(s, s.legalMask());
+}
+
+void writeActionMask(uint64_t actions, uint8_t* mask) {
+    for (int a = 0; a < NUM_ACTIONS; a++) mask[a] = actions >> a & 1;
+}
+
+void writeActionMask(const GameState& s, uint8_t* mask) {
+    writeActionMask(legalActions(s), mask);
+}
+
+void applyAction(GameState& s, int action, FastRng& rng) {
+    if (action == ACTION_DRAW) {
+        s.draw();
+        s.resolveDraws(rng);
+    } else {
+        s.play(actionToKind(action), action < 52 ? NONE : (Color)((action - 52) % 4));
+    }
+}
+
+class ObservationEncoder {
+public:
+    static const int HAND = 0;
+    static const int TOP = HAND + NUM_KINDS;
+    static const int COLOR = TOP + NUM_KINDS;
+    static const int DIRECTION = COLOR + 4;
+    static const int OPPONENTS = DIRECTION + 2;
+    static const int DISCARDED = OPPONENTS + 3;
+    static const int PENALTY = DISCARDED + NUM_KINDS;
+    static const int DRAWN = PENALTY + 1;
+    static const int SIZE = DRAWN + 1;
+
+    static void encode(const GameState& s, int seat, float* out) {
+        memset(out, 0, SIZE * sizeof(float));
+        const uint8_t* hand = s.hands[seat];
+        for (int k = 0; k < NUM_KINDS; k++) {
+            out[HAND + k] = hand[k];
+            out[DISCARDED + k] = s.discarded[k] * kindTable.inverseCopies[k];
+        }
+        out[TOP + s.topKind] = 1;
+        out[COLOR + s.currentColor] = 1;
+        out[DIRECTION + (s.direction > 0)] = 1;
+        for (int i = 1; i <= 3; i++) out[OPPONENTS + i - 1] = s.handSize[(seat + i * s.direction + 4) % 4] * 0.1f;
+        out[PENALTY] = s.pendingPenalty * 0.25f;
+        out[DRAWN] = s.drawnKind >= 0;
+    }
+
+    static void encode(const GameState& s, int seat, int8_t* out) {
+        memset(out, 0, SIZE);
+        const uint8_t* hand = s.hands[seat];
+        for (int k = 0; k < NUM_KINDS; k++) {
+            out[HAND + k] = (int8_t)min<int>(hand[k], 127);
+            out[DISCARDED + k] = (int8_t)min<int>(s.discarded[k], 127);
+        }
+        out[TOP + s.topKind] = 1;
+        out[COLOR + s.currentColor] = 1;
+        out[DIRECTION + (s.direction > 0)] = 1;
+        for (int i = 1; i <= 3; i++) out[OPPONENTS + i - 1] = (int8_t)min(s.handSize[(seat + i * s.direction + 4) % 4], 127);
+        out[PENALTY] = (int8_t)min(s.pendingPenalty, 127);
+        out[DRAWN] = s.drawnKind >= 0;
+    }
+
+    template <class T>
+    static void encodeBatch(const GameState* states, const int* seats, int count, T* out) {
+        for (int i = 0; i < count; i++) encode(states[i], seats ? seats[i] : states[i].currentPlayer, out + (size_t)i * SIZE);
+    }
+};
+
+const int OBS_SIZE = ObservationEncoder::SIZE;
+
+template <class Policy>
+int policyAction(const GameState& s, Policy* p) {
+    uint64_t legal = s.legalMask();
+    int kind;
+    if (s.drawnKind >= 0) kind = p->playDrawn(s, s.drawnKind) ? s.drawnKind : DRAW_MOVE;
+    else if (s.pendingPenalty > 0) kind = (legal && p->stackOrTake(s, legal)) ? __builtin_ctzll(legal) : DRAW_MOVE;
+    else kind = legal ? p->chooseCard(s, legal) : DRAW_MOVE;
+
+    if (kind == DRAW_MOVE) return ACTION_DRAW;
+    if (kind == KIND_WILD) return 52 + p->chooseColor(s);
+    if (kind == KIND_WILD_DRAW_FOUR) return 56 + p->chooseColor(s);
+    return kind;
+}
+
+template <class Policy>
+int playTurn(GameState& s, Policy* p, FastRng& rng) {
+    int action = policyAction(s, p);
+    applyAction(s, action, rng);
+    return actionToKind(action);
+}
+
+template <class Policy>
+bool anyObserver(Policy* const seats[4]) {
+    for (int i = 0; i < 4; i++)
+        if (seats[i] && seats[i]->observes()) return true;
+    return false;
+}
+
+template <class Policy>
+int stepGame(GameState& s, int action, FastRng& rng, Policy* const seats[4], bool observed) {
+    if (!observed) {
+        applyAction(s, action, rng);
+        return actionToKind(action);
+    }
+    GameState before = s;
+    int seat = s.currentPlayer;
+    applyAction(s, action, rng);
+    int kind = actionToKind(action);
+    for (int i = 0; i < 4; i++)
+        if (seats[i] && seats[i]->observes() && find(seats, seats + i, seats[i]) == seats + i) seats[i]->observe(before, s, seat, kind);
+    return kind;
+}
+
+template <class Policy>
+int playGame(GameState& s, Policy* const seats[4], FastRng& rng, int maxTurns = 2000) {
+    bool observed = anyObserver(seats);
+    while (s.winner < 0 && s.turns < maxTurns) stepGame(s, policyAction(s, seats[s.currentPlayer]), rng, seats, observed);
+    return s.winner;
+}
+
+class BotPolicy {
+public:
+    virtual ~BotPolicy() {}
+    virtual string name() const = 0;
+    virtual int chooseCard(const GameState& s, uint64_t legal) = 0;
+    virtual Color chooseColor(const GameState& s) = 0;
+    virtual bool stackOrTake(const GameState& s, uint64_t stackable) = 0;
+    virtual bool playDrawn(const GameState& s, int kind) = 0;
+    virtual void reset(uint64_t seed) {}
+    virtual bool observes() const { return false; }
+    virtual void observe(const GameState& before, const GameState& after, int seat, int kind) {}
+    virtual bool ponders() const { return false; }
+    virtual bool ponder(const GameState& s, int iterations) { return false; }
+};
+
+class FirstPlayablePolicy final : public BotPolicy {
+public:
+    FastRng rng;
+
+    FirstPlayablePolicy(uint64_t seed = 1) : rng(seed) {}
+
+    void reset(uint64_t seed) override {
+        rng = FastRng(seed);
+    }
+
+    string name() const override { return "first"; }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        return legal ? __builtin_ctzll(legal) : DRAW_MOVE;
+    }
+
+    Color chooseColor(const GameState& s) override {
+        return (Color)rng.below(4);
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        return true;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        return true;
+    }
+};
+
+class RandomPolicy final : public BotPolicy {
+public:
+    FastRng rng;
+
+    RandomPolicy(uint64_t seed = 1) : rng(seed) {}
+
+    void reset(uint64_t seed) override {
+        rng = FastRng(seed);
+    }
+
+    string name() const override { return "random"; }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        if (!legal) return DRAW_MOVE;
+        for (int skip = rng.below(__builtin_popcountll(legal)); skip > 0; skip--) legal &= legal - 1;
+        return __builtin_ctzll(legal);
+    }
+
+    Color chooseColor(const GameState& s) override {
+        return (Color)rng.below(4);
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        return rng.below(2) == 0;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        return rng.below(2) == 0;
+    }
+};
+
+class GreedyPolicy final : public BotPolicy {
+public:
+    FastRng rng;
+
+    GreedyPolicy(uint64_t seed = 1) : rng(seed) {}
+
+    void reset(uint64_t seed) override {
+        rng = FastRng(seed);
+    }
+
+    string name() const override { return "greedy"; }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        int seat = s.currentPlayer;
+        bool threat = s.handSize[s.nextSeat(seat)] <= 2;
+        int bestKind = DRAW_MOVE, bestScore = -1000;
+        for (uint64_t m = legal; m; m &= m - 1) {
+            int k = __builtin_ctzll(m);
+            int score;
+            if (k == KIND_WILD_DRAW_FOUR) score = threat ? 30 : -15;
+            else if (k == KIND_WILD) score = -10;
+            else {
+                score = 2 * s.colorCount(seat, kindTable.color[k]);
+                if (kindTable.type[k] != NUMBER) score += threat ? 20 : -1;
+            }
+            if (score > bestScore) {
+                bestScore = score;
+                bestKind = k;
+            }
+        }
+        return bestKind;
+    }
+
+    Color chooseColor(const GameState& s) override {
+        Color best = (Color)rng.below(4);
+        for (int c = RED; c <= YELLOW; c++)
+            if (s.colorCount(s.currentPlayer, (Color)c) > s.colorCount(s.currentPlayer, best)) best = (Color)c;
+        return best;
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        return true;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        return true;
+    }
+};
+
+enum HeuristicWeight {
+    W_COLOR_COUNT, W_ACTION_THREAT, W_ACTION_CALM, W_WILD, W_WILD_DRAW_FOUR, W_WILD_DRAW_FOUR_THREAT,
+    W_STACK_BIAS, W_STACK_PER_CARD, W_PLAY_DRAWN, NUM_HEURISTIC_WEIGHTS
+};
+
+const char* HEURISTIC_WEIGHT_NAMES[NUM_HEURISTIC_WEIGHTS] = {
+    "color_count", "action_threat", "action_calm", "wild", "wild_draw_four", "wild_draw_four_threat",
+    "stack_bias", "stack_per_card", "play_drawn"
+};
+
+vector<double> defaultHeuristicWeights() {
+    return { 2, 20, -1, -10, -15, 30, 1, 0, 1 };
+}
+
+class HeuristicPolicy final : public BotPolicy {
+public:
+    vector<double> weights;
+    FastRng rng;
+
+    HeuristicPolicy(vector<double> w, uint64_t seed = 1) : rng(seed) {
+        weights = w;
+    }
+
+    string name() const override { return "heuristic"; }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        int seat = s.currentPlayer;
+        bool threat = s.handSize[s.nextSeat(seat)] <= 2;
+        int counts[4];
+        handKernels.colorCounts(s.hands[seat], counts);
+        int bestKind = DRAW_MOVE;
+        double bestScore = -1e18;
+        for (uint64_t m = legal; m; m &= m - 1) {
+            int k = __builtin_ctzll(m);
+            double score;
+            if (k == KIND_WILD_DRAW_FOUR) score = threat ? weights[W_WILD_DRAW_FOUR_THREAT] : weights[W_WILD_DRAW_FOUR];
+            else if (k == KIND_WILD) score = weights[W_WILD];
+            else {
+                score = weights[W_COLOR_COUNT] * counts[kindTable.color[k]];
+                if (kindTable.type[k] != NUMBER) score += threat ? weights[W_ACTION_THREAT] : weights[W_ACTION_CALM];
+            }
+            if (score > bestScore) {
+                bestScore = score;
+                bestKind = k;
+            }
+        }
+        return bestKind;
+    }
+
+    Color chooseColor(const GameState& s) override {
+        int counts[4];
+        handKernels.colorCounts(s.hands[s.currentPlayer], counts);
+        Color best = (Color)rng.below(4);
+        for (int c = RED; c <= YELLOW; c++)
+            if (counts[c] > counts[best]) best = (Color)c;
+        return best;
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        return weights[W_STACK_BIAS] + weights[W_STACK_PER_CARD] * s.pendingPenalty > 0;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        return weights[W_PLAY_DRAWN] > 0;
+    }
+
+    void reset(uint64_t seed) override {
+        rng = FastRng(seed);
+    }
+};
+
+json heuristicWeightsToJson(const vector<double>& weights) {
+    json j;
+    for (int i = 0; i < NUM_HEURISTIC_WEIGHTS; i++) j[HEURISTIC_WEIGHT_NAMES[i]] = weights[i];
+    return j;
+}
+
+vector<double> heuristicWeightsFromJson(const json& j) {
+    vector<double> weights = defaultHeuristicWeights();
+    for (int i = 0; i < NUM_HEURISTIC_WEIGHTS; i++)
+        if (j.contains(HEURISTIC_WEIGHT_NAMES[i])) weights[i] = j[HEURISTIC_WEIGHT_NAMES[i]];
+    return weights;
+}
+
+class TrackingPolicy final : public BotPolicy {
+public:
+    CardTracker trackers[4];
+    FastRng rng;
+
+    TrackingPolicy(uint64_t seed = 1) : rng(seed) {
+        for (int i = 0; i < 4; i++) trackers[i] = CardTracker(i);
+    }
+
+    string name() const override { return "tracking"; }
+
+    CardTracker& tracker(const GameState& s) {
+        CardTracker& t = trackers[s.currentPlayer];
+        if (!t.synced(s)) t.reset(s);
+        return t;
+    }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        int seat = s.currentPlayer;
+        int next = s.nextSeat(seat);
+        bool threat = s.handSize[next] <= 2;
+        CardTracker& t = tracker(s);
+        int counts[4];
+        handKernels.colorCounts(s.hands[seat], counts);
+        int bestKind = DRAW_MOVE;
+        double bestScore = -1e18;
+        for (uint64_t m = legal; m; m &= m - 1) {
+            int k = __builtin_ctzll(m);
+            double score;
+            if (k == KIND_WILD_DRAW_FOUR) score = threat ? 30 : -15;
+            else if (k == KIND_WILD) score = -10;
+            else {
+                Color c = kindTable.color[k];
+                score = 2 * counts[c] + 3 * t.colorVoidProbability(s, next, c);
+                if (kindTable.type[k] != NUMBER) score += threat ? 20 : -1;
+            }
+            if (score > bestScore) {
+                bestScore = score;
+                bestKind = k;
+            }
+        }
+        return bestKind;
+    }
+
+    Color chooseColor(const GameState& s) override {
+        int seat = s.currentPlayer;
+        CardTracker& t = tracker(s);
+        int counts[4];
+        handKernels.colorCounts(s.hands[seat], counts);
+        Color best = (Color)rng.below(4);
+        double bestScore = -1;
+        for (int c = RED; c <= YELLOW; c++) {
+            double score = counts[c] + t.colorVoidProbability(s, s.nextSeat(seat), (Color)c);
+            if (score > bestScore) {
+                bestScore = score;
+                best = (Color)c;
+            }
+        }
+        return best;
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        return true;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        return true;
+    }
+
+    void reset(uint64_t seed) override {
+        rng = FastRng(seed);
+    }
+
+    bool observes() const override { return true; }
+
+    void observe(const GameState& before, const GameState& after, int seat, int kind) override {
+        for (auto& t : trackers) t.observe(before, after, seat, kind);
+    }
+};
+
+struct SearchNode {
+    int child;
+    int sibling;
+    int8_t action;
+    int8_t actor;
+    int visits;
+    int availability;
+    float reward;
+};
+
+struct SearchTree {
+    vector<GameState> arena;
+    vector<SearchNode> nodes;
+    GreedyPolicy rollout;
+    FastRng rng;
+
+    SearchTree(int iters, uint64_t seed) : arena(iters), rollout(seed), rng(seed) {}
+};
+
+const int PONDER_CHUNK = 64;
+
+struct PonderBranch {
+    uint64_t key;
+    CardTracker tracker;
+    DeterminizationSampler sampler;
+    SearchTree tree;
+    int grown;
+    bool ready;
+
+    PonderBranch(uint64_t k, const GameState& root) : key(k), tracker(root.currentPlayer), tree(PONDER_CHUNK, k) {
+        tracker.reset(root);
+        ready = sampler.prepare(tracker, root);
+        grown = 0;
+    }
+};
+
+class IsmctsPolicy final : public BotPolicy {
+public:
+    int iterations;
+    double exploration;
+    CardTracker trackers[4];
+    DeterminizationSampler sampler;
+    vector<SearchTree> forest;
+    vector<PonderBranch> branches;
+    GreedyPolicy rollout;
+    int chosenAction;
+
+    IsmctsPolicy(int iters = 1000, uint64_t seed = 1, int trees = 1) : rollout(seed) {
+        iterations = iters;
+        exploration = 0.7;
+        chosenAction = ACTION_DRAW;
+        for (int i = 0; i < 4; i++) trackers[i] = CardTracker(i);
+        for (int i = 0; i < max(1, trees); i++) forest.emplace_back(iters, seed + i * 0x9E3779B97F4A7C15ULL);
+    }
+
+    string name() const override { return "ismcts"; }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        if (__builtin_popcountll(legal) == 1 && !kindTable.isWild(__builtin_ctzll(legal))) {
+            branches.clear();
+            return __builtin_ctzll(legal);
+        }
+        chosenAction = search(s);
+        return actionToKind(chosenAction);
+    }
+
+    Color chooseColor(const GameState& s) override {
+        if (chosenAction >= 52 && chosenAction < ACTION_DRAW) return (Color)((chosenAction - 52) % 4);
+        return rollout.chooseColor(s);
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        chosenAction = search(s);
+        return chosenAction != ACTION_DRAW;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        chosenAction = search(s);
+        return chosenAction != ACTION_DRAW;
+    }
+
+    void reset(uint64_t seed) override {
+        rollout.reset(seed);
+        branches.clear();
+        for (int i = 0; i < (int)forest.size(); i++) {
+            forest[i].rollout.reset(seed + i * 0x9E3779B97F4A7C15ULL);
+            forest[i].rng = FastRng(seed + i * 0x9E3779B97F4A7C15ULL);
+        }
+    }
+
+    bool observes() const override { return true; }
+
+    void observe(const GameState& before, const GameState& after, int seat, int kind) override {
+        for (auto& t : trackers) t.observe(before, after, seat, kind);
+    }
+
+    bool ponders() const override { return true; }
+
+    bool ponder(const GameState& s, int count) override {
+        PonderBranch* branch = findBranch(s);
+        if (!branch) {
+            branches.emplace_back(ponderKey(s), s);
+            branch = &branches.back();
+            plant(branch->tree);
+        }
+        int budget = iterations * (int)forest.size();
+        int n = min({ count, budget - branch->grown, (int)branch->tree.arena.size() });
+        if (!branch->ready || n <= 0) return false;
+        branch->sampler.sampleBatch(branch->tree.rng, branch->tree.arena.data(), n);
+        grow(branch->tree, branch->tree.arena.data(), n);
+        branch->grown += n;
+        return branch->grown < budget;
+    }
+
+private:
+    static uint64_t ponderKey(const GameState& s) {
+        const uint64_t* words = (const uint64_t*)s.hands[s.currentPlayer];
+        uint64_t h = 0x84222325CBF29CE4ULL;
+        for (int i = 0; i < KIND_LANES / 8; i++) h = (h ^ words[i]) * 0x100000001B3ULL;
+        words = (const uint64_t*)s.discarded;
+        for (int i = 0; i < KIND_LANES / 8; i++) h = (h ^ words[i]) * 0x100000001B3ULL;
+        for (int i = 0; i < 4; i++) h = (h ^ (uint64_t)s.handSize[i]) * 0x100000001B3ULL;
+        uint64_t tail = (uint64_t)s.topKind | (uint64_t)s.currentColor << 8 | (uint64_t)s.currentPlayer << 12
+            | (uint64_t)(s.direction + 1) << 16 | (uint64_t)s.pendingPenalty << 20 | (uint64_t)s.pendingType << 28
+            | (uint64_t)(s.drawnKind + 1) << 32 | (uint64_t)s.deckSize << 40 | (uint64_t)s.allDiscardRule << 56;
+        h = (h ^ tail) * 0x100000001B3ULL;
+        return h ^ (h >> 29);
+    }
+
+    PonderBranch* findBranch(const GameState& s) {
+        uint64_t key = ponderKey(s);
+        for (PonderBranch& b : branches)
+            if (b.key == key) return &b;
+        return nullptr;
+    }
+
+    int search(const GameState& s) {
+        uint64_t rootActions = legalActions(s);
+        int visits[NUM_ACTIONS] = {};
+        PonderBranch* branch = findBranch(s);
+        if (branch && branch->ready) {
+            for (int left = iterations * (int)forest.size() - branch->grown; left > 0; left -= iterations) {
+                int n = min(left, iterations);
+                branch->sampler.sampleBatch(branch->tree.rng, forest[0].arena.data(), n);
+                grow(branch->tree, forest[0].arena.data(), n);
+            }
+            tally(branch->tree, visits);
+            branches.clear();
+        } else {
+            branches.clear();
+            CardTracker& t = trackers[s.currentPlayer];
+            if (!t.synced(s)) t.reset(s);
+            if (!sampler.prepare(t, s)) return __builtin_ctzll(rootActions);
+            for (SearchTree& tree : forest) {
+                plant(tree);
+                sampler.sampleBatch(tree.rng, tree.arena.data(), iterations);
+            }
+            if (forest.size() == 1) grow(forest[0], forest[0].arena.data(), iterations);
+            else {
+                TaskGroup group;
+                for (SearchTree& tree : forest) group.run([this, &tree] { grow(tree, tree.arena.data(), iterations); });
+                group.wait();
+            }
+            for (const SearchTree& tree : forest) tally(tree, visits);
+        }
+        int bestAction = __builtin_ctzll(rootActions), bestVisits = -1;
+        for (uint64_t m = rootActions; m; m &= m - 1) {
+            int action = __builtin_ctzll(m);
+            if (visits[action] > bestVisits) {
+                bestVisits = visits[action];
+                bestAction = action;
+            }
+        }
+        return bestAction;
+    }
+
+    static void tally(const SearchTree& tree, int* visits) {
+        for (int c = tree.nodes[0].child; c >= 0; c = tree.nodes[c].sibling) visits[tree.nodes[c].action] += tree.nodes[c].visits;
+    }
+
+    static void plant(SearchTree& tree) {
+        tree.nodes.clear();
+        tree.nodes.push_back({ -1, -1, -1, -1, 0, 0, 0 });
+    }
+
+    void grow(SearchTree& tree, GameState* samples, int count) {
+        vector<SearchNode>& nodes = tree.nodes;
+        FastRng& rng = tree.rng;
+        GreedyPolicy* seats[4] = { &tree.rollout, &tree.rollout, &tree.rollout, &tree.rollout };
+        int path[256];
+        for (int it = 0; it < count; it++) {
+            GameState& d = samples[it];
+            int node = 0, depth = 0;
+            path[depth++] = 0;
+            while (d.winner < 0 && depth < 255) {
+                uint64_t actions = legalActions(d);
+                uint64_t untried = actions;
+                int best = -1;
+                double bestScore = -1;
+                for (int c = nodes[node].child; c >= 0; c = nodes[c].sibling) {
+                    if (!(actions >> nodes[c].action & 1)) continue;
+                    untried &= ~(1ULL << nodes[c].action);
+                    SearchNode& n = nodes[c];
+                    n.availability++;
+                    double score = n.reward / n.visits + exploration * sqrt(log((double)n.availability) / n.visits);
+                    if (score > bestScore) {
+                        bestScore = score;
+                        best = c;
+                    }
+                }
+                if (untried) {
+                    int skip = rng.below(__builtin_popcountll(untried));
+                    for (; skip > 0; skip--) untried &= untried - 1;
+                    int action = __builtin_ctzll(untried);
+                    nodes.push_back({ -1, nodes[node].child, (int8_t)action, (int8_t)d.currentPlayer, 0, 1, 0 });
+                    nodes[node].child = (int)nodes.size() - 1;
+                    node = nodes[node].child;
+                    path[depth++] = node;
+                    applyAction(d, action, rng);
+                    break;
+                }
+                node = best;
+                path[depth++] = node;
+                applyAction(d, nodes[node].action, rng);
+            }
+            int winner = d.winner >= 0 ? d.winner : playGame(d, seats, rng, d.turns + 500);
+            for (int i = 0; i < depth; i++) {
+                nodes[path[i]].visits++;
+                if (winner >= 0 && nodes[path[i]].actor == winner) nodes[path[i]].reward += 1;
+            }
+        }
+    }
+};
+
+template <class Fallback>
+class EndgamePolicy final : public BotPolicy {
+public:
+    Fallback fallback;
+    EndgameSolver solver;
+    int solvedKind;
+    Color solvedColor;
+
+    EndgamePolicy(uint64_t seed = 1) : fallback(seed) {
+        solvedKind = DRAW_MOVE;
+        solvedColor = NONE;
+    }
+
+    string name() const override { return "endgame-" + fallback.name(); }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        solvedKind = DRAW_MOVE;
+        if (!solver.applies(s)) return fallback.chooseCard(s, legal);
+        EndgameResult r = solver.solve(s);
+        if (!trusted(r)) return fallback.chooseCard(s, legal);
+        solvedKind = r.bestKind;
+        solvedColor = r.bestColor;
+        return r.bestKind;
+    }
+
+    Color chooseColor(const GameState& s) override {
+        if (solvedKind != DRAW_MOVE && solvedColor != NONE) return solvedColor;
+        return fallback.chooseColor(s);
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        solvedKind = DRAW_MOVE;
+        if (!solver.applies(s)) return fallback.stackOrTake(s, stackable);
+        EndgameResult r = solver.solve(s);
+        if (!trusted(r)) return fallback.stackOrTake(s, stackable);
+        solvedKind = r.bestKind;
+        solvedColor = r.bestColor;
+        return r.bestKind != DRAW_MOVE;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        return fallback.playDrawn(s, kind);
+    }
+
+    void reset(uint64_t seed) override {
+        fallback.reset(seed);
+    }
+
+private:
+    static bool trusted(const EndgameResult& r) {
+        return r.exact || r.slack <= ENDGAME_MAX_SLACK;
+    }
+};
+
+struct QuantLayer {
+    int in;
+    int out;
+    int stride;
+    float weightScale;
+    vector<int8_t> weights;
+    vector<int8_t> packed;
+    vector<float> bias;
+};
+
+class MlpNetwork {
+public:
+    vector<QuantLayer> layers;
+
+    static const uint32_t MAX_LAYERS = 16;
+    static const uint32_t MAX_WIDTH = 4096;
+
+    MlpNetwork() {
+        widest = 0;
+        widestStride = 0;
+    }
+
+    bool load(string path) {
+        ifstream in(path, ios::binary);
+        char magic[8];
+        uint32_t count = 0;
+        if (!in.read(magic, 8) || memcmp(magic, "UNOMLP1", 8) != 0) return false;
+        if (!in.read((char*)&count, 4) || count == 0 || count > MAX_LAYERS)
+            throw runtime_error(path + ": bad layer count " + to_string(count));
+        layers.clear();
+        for (uint32_t l = 0; l < count; l++) {
+            uint32_t rows, cols;
+            QuantLayer layer;
+            in.read((char*)&cols, 4);
+            in.read((char*)&rows, 4);
+            in.read((char*)&layer.weightScale, 4);
+            if (!in) throw runtime_error(path + ": truncated header for layer " + to_string(l));
+            uint32_t expected = l == 0 ? (uint32_t)OBS_SIZE : (uint32_t)layers.back().out;
+            if (cols != expected)
+                throw runtime_error(path + ": layer " + to_string(l) + " takes " + to_string(cols) + " inputs, expected " + to_string(expected));
+            if (rows == 0 || rows > MAX_WIDTH)
+                throw runtime_error(path + ": layer " + to_string(l) + " has " + to_string(rows) + " outputs");
+            if (!isfinite(layer.weightScale)) throw runtime_error(path + ": layer " + to_string(l) + " has a non-finite scale");
+            layer.in = cols;
+            layer.out = rows;
+            layer.stride = (cols + 63) & ~63;
+            layer.weights.assign((size_t)rows * layer.stride, 0);
+            for (uint32_t r = 0; r < rows; r++) in.read((char*)&layer.weights[(size_t)r * layer.stride], cols);
+            layer.bias.resize(rows);
+            in.read((char*)layer.bias.data(), rows * 4);
+            if (!in) throw runtime_error(path + ": truncated weights for layer " + to_string(l));
+            layers.push_back(layer);
+        }
+        if (layers.back().out != NUM_ACTIONS)
+            throw runtime_error(path + ": network has " + to_string(layers.back().out) + " outputs, expected " + to_string(NUM_ACTIONS));
+        prepare();
+        return true;
+    }
+
+    void save(string path) {
+        ofstream out(path, ios::binary);
+        uint32_t count = layers.size();
+        out.write("UNOMLP1", 8);
+        out.write((const char*)&count, 4);
+        for (auto& layer : layers) {
+            uint32_t cols = layer.in, rows = layer.out;
+            out.write((const char*)&cols, 4);
+            out.write((const char*)&rows, 4);
+            out.write((const char*)&layer.weightScale, 4);
+            for (int r = 0; r < layer.out; r++) out.write((const char*)&layer.weights[(size_t)r * layer.stride], cols);
+            out.write((const char*)layer.bias.data(), rows * 4);
+        }
+    }
+
+    void randomize(vector<int> sizes, uint64_t seed) {
+        FastRng rng(seed);
+        layers.clear();
+        for (int l = 0; l + 1 < (int)sizes.size(); l++) {
+            QuantLayer layer;
+            layer.in = sizes[l];
+            layer.out = sizes[l + 1];
+            layer.stride = (layer.in + 63) & ~63;
+            layer.weightScale = 1.0f / (127.0f * sqrt((float)layer.in));
+            layer.weights.assign((size_t)layer.out * layer.stride, 0);
+            for (int r = 0; r < layer.out; r++)
+                for (int i = 0; i < layer.in; i++) layer.weights[(size_t)r * layer.stride + i] = (int8_t)(rng.below(255) - 127);
+            layer.bias.assign(layer.out, 0);
+            layers.push_back(layer);
+        }
+        prepare();
+    }
+
+    void forward(const float* input, float* logits) {
+        forwardBatch(input, 1, logits);
+    }
+
+    void forwardBatch(const float* inputs, int count, float* logits) {
+        if (count <= 0) return;
+        activations.resize((size_t)count * widestStride);
+        hiddenA.resize((size_t)count * widest);
+        hiddenB.resize((size_t)count * widest);
+        scales.resize(count);
+        const float* x = inputs;
+        int n = layers[0].in;
+        for (int l = 0; l < (int)layers.size(); l++) {
+            QuantLayer& layer = layers[l];
+            for (int b = 0; b < count; b++)
+                scales[b] = layer.weightScale * int8Kernels.quantize(x + (size_t)b * n, n, layer.stride, &activations[(size_t)b * layer.stride]);
+            bool last = l + 1 == (int)layers.size();
+            float* y = last ? logits : (x == hiddenA.data() ? hiddenB.data() : hiddenA.data());
+            int8Kernels.gemm(layer.packed.data(), layer.out, layer.stride, activations.data(), count, scales.data(), layer.bias.data(), !last, y);
+            x = y;
+            n = layer.out;
+        }
+    }
+
+private:
+    int widest;
+    int widestStride;
+    vector<uint8_t> activations;
+    vector<float> hiddenA;
+    vector<float> hiddenB;
+    vector<float> scales;
+
+    void prepare() {
+        widest = 0;
+        widestStride = 0;
+        for (auto& layer : layers) {
+            widest = max(widest, max(layer.in, layer.out));
+            widestStride = max(widestStride, layer.stride);
+            int block = int8Kernels.gemmBlock;
+            layer.packed.assign((size_t)(layer.out + block - 1) / block * block * layer.stride, 0);
+            packInt8Weights(layer.weights.data(), layer.out, layer.stride, block, layer.packed.data());
+        }
+    }
+};
+
+int maskedArgmax(const float* logits, const uint8_t* mask) {
+    int best = -1;
+    for (int a = 0; a < NUM_ACTIONS; a++)
+        if (mask[a] && (best < 0 || logits[a] > logits[best])) best = a;
+    return best < 0 ? ACTION_DRAW : best;
+}
+
+class NNPolicy final : public BotPolicy {
+public:
+    MlpNetwork net;
+    int lastAction;
+    float obs[OBS_SIZE];
+    float logits[NUM_ACTIONS];
+    uint8_t mask[NUM_ACTIONS];
+
+    NNPolicy(const MlpNetwork& network) : net(network) {
+        lastAction = ACTION_DRAW;
+    }
+
+    string name() const override { return "nn"; }
+
+    int decide(const GameState& s, uint64_t legal) {
+        ObservationEncoder::encode(s, s.currentPlayer, obs);
+        writeActionMask(legalActions(s, legal), mask);
+        net.forward(obs, logits);
+        lastAction = maskedArgmax(logits, mask);
+        return lastAction;
+    }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        return actionToKind(decide(s, legal));
+    }
+
+    Color chooseColor(const GameState& s) override {
+        if (lastAction >= 52 && lastAction < 60) return (Color)((lastAction - 52) % 4);
+        Color best = RED;
+        for (int c = GREEN; c <= YELLOW; c++)
+            if (s.colorCount(s.currentPlayer, (Color)c) > s.colorCount(s.currentPlayer, best)) best = (Color)c;
+        return best;
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        return decide(s, stackable) != ACTION_DRAW;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        return decide(s, 1ULL << kind) != ACTION_DRAW;
+    }
+};
+
+enum CfrDecision { CFR_STACK, CFR_COLOR };
+
+struct CfrAbstraction {
+    static const int MAX_COLOR_CAP = 7;
+    static const int MAX_BUCKETS = 16;
+
+    int colorCap;
+    int opponentBuckets;
+    int stackBuckets;
+
+    void validate(string path) const {
+        if (colorCap < 0 || colorCap > MAX_COLOR_CAP)
+            throw runtime_error(path + ": color cap " + to_string(colorCap) + " is out of range");
+        if (opponentBuckets < 1 || opponentBuckets > MAX_BUCKETS || stackBuckets < 1 || stackBuckets > MAX_BUCKETS)
+            throw runtime_error(path + ": bucket counts " + to_string(opponentBuckets) + "x" + to_string(stackBuckets) + " are out of range");
+    }
+
+    int handBuckets() const {
+        return (colorCap + 1) * (colorCap + 1) * (colorCap + 1) * (colorCap + 1);
+    }
+
+    int size() const {
+        return 2 * handBuckets() * opponentBuckets * stackBuckets;
+    }
+
+    int index(CfrDecision decision, const GameState& s, int seat) const {
+        int counts[4];
+        handKernels.colorCounts(s.hands[seat], counts);
+        int hand = 0;
+        for (int c = 0; c < 4; c++) hand = hand * (colorCap + 1) + min(counts[c], colorCap);
+        int opp = max(0, min(s.handSize[s.nextSeat(seat)], opponentBuckets) - 1);
+        int stack = min(s.pendingPenalty / 2, stackBuckets - 1);
+        return ((decision * handBuckets() + hand) * opponentBuckets + opp) * stackBuckets + stack;
+    }
+};
+
+const int CFR_ACTIONS = 4;
+
+class CfrPolicyTable {
+public:
+    CfrAbstraction abstraction;
+    vector<uint8_t> probs;
+
+    bool load(string path) {
+        ifstream in(path, ios::binary);
+        char magic[8];
+        uint32_t size = 0;
+        if (!in.read(magic, 8) || memcmp(magic, "UNOCFRP", 8) != 0) return false;
+        in.read((char*)&abstraction, sizeof(abstraction));
+        in.read((char*)&size, 4);
+        if (!in) throw runtime_error(path + ": truncated header");
+        abstraction.validate(path);
+        if (size != (uint32_t)abstraction.size())
+            throw runtime_error(path + ": table has " + to_string(size) + " infosets, expected " + to_string(abstraction.size()));
+        probs.resize((size_t)size * CFR_ACTIONS);
+        if (!in.read((char*)probs.data(), probs.size())) throw runtime_error(path + ": truncated table");
+        if (in.peek() != EOF) throw runtime_error(path + ": trailing data after table");
+        return true;
+    }
+
+    int sample(int infoset, int actions, FastRng& rng) const {
+        const uint8_t* p = &probs[(size_t)infoset * CFR_ACTIONS];
+        int total = 0;
+        for (int a = 0; a < actions; a++) total += p[a];
+        if (total == 0) return rng.below(actions);
+        int r = rng.below(total);
+        for (int a = 0; a < actions; a++)
+            if ((r -= p[a]) < 0) return a;
+        return actions - 1;
+    }
+};
+
+class CfrPolicy final : public BotPolicy {
+public:
+    CfrPolicyTable table;
+    GreedyPolicy base;
+    FastRng rng;
+
+    CfrPolicy(const CfrPolicyTable& t, uint64_t seed = 1) : table(t), base(seed), rng(seed) {}
+
+    string name() const override { return "cfr"; }
+
+    int chooseCard(const GameState& s, uint64_t legal) override {
+        return base.chooseCard(s, legal);
+    }
+
+    Color chooseColor(const GameState& s) override {
+        return (Color)table.sample(table.abstraction.index(CFR_COLOR, s, s.currentPlayer), 4, rng);
+    }
+
+    bool stackOrTake(const GameState& s, uint64_t stackable) override {
+        return table.sample(table.abstraction.index(CFR_STACK, s, s.currentPlayer), 2, rng) == 0;
+    }
+
+    bool playDrawn(const GameState& s, int kind) override {
+        return base.playDrawn(s, kind);
+    }
+
+    void reset(uint64_t seed) override {
+        base.reset(seed);
+        rng = FastRng(seed);
+    }
+};
+
+unique_ptr<BotPolicy> makePolicy(const string& name, uint64_t seed = 1) {
+    if (name == "first") return unique_ptr<BotPolicy>(new FirstPlayablePolicy(seed));
+    if (name == "random") return unique_ptr<BotPolicy>(new RandomPolicy(seed));
+    if (name == "greedy") return unique_ptr<BotPolicy>(new GreedyPolicy(seed));
+    if (name == "endgame") return unique_ptr<BotPolicy>(new EndgamePolicy<GreedyPolicy>(seed));
+    if (name == "tracking") return unique_ptr<BotPolicy>(new TrackingPolicy(seed));
+    if (name == "ismcts") return unique_ptr<BotPolicy>(new IsmctsPolicy(1000, seed));
+    if (name.rfind("ismcts:", 0) == 0) {
+        int iterations = atoi(name.substr(7).c_str());
+        size_t colon = name.find(':', 7);
+        int trees = colon == string::npos ? 1 : atoi(name.substr(colon + 1).c_str());
+        if (iterations <= 0 || trees <= 0) return nullptr;
+        return unique_ptr<BotPolicy>(new IsmctsPolicy(iterations, seed, trees));
+    }
+    if (name == "heuristic") return unique_ptr<BotPolicy>(new HeuristicPolicy(defaultHeuristicWeights(), seed));
+    if (name.rfind("heuristic:", 0) == 0) {
+        ifstream in(name.substr(10));
+        if (!in) return nullptr;
+        json weights;
+        in >> weights;
+        return unique_ptr<BotPolicy>(new HeuristicPolicy(heuristicWeightsFromJson(weights), seed));
+    }
+    if (name.rfind("nn:", 0) == 0) {
+        MlpNetwork net;
+        try {
+            if (!net.load(name.substr(3))) return nullptr;
+        } catch (const runtime_error& e) {
+            cout << "Invalid network: " << e.what() << endl;
+            return nullptr;
+        }
+        return unique_ptr<BotPolicy>(new NNPolicy(net));
+    }
+    if (name.rfind("cfr:", 0) == 0) {
+        CfrPolicyTable table;
+        try {
+            if (!table.load(name.substr(4))) return nullptr;
+        } catch (const runtime_error& e) {
+            cout << "Invalid policy table: " << e.what() << endl;
+            return nullptr;
+        }
+        return unique_ptr<BotPolicy>(new CfrPolicy(table, seed));
+    }
+    return nullptr;
+}
+
+enum GamePhase { TURN_START, AWAIT_CARD, AWAIT_COLOR, AWAIT_STACK, RESOLVE_PENALTY, GAME_OVER };
+
+class Game {
+public:
+    Deck deck;
+    vector<Player> players;
+    int currentPlayer;
+    int direction;
+    Color currentColor;
+    bool allDiscardRule;
+    string playerName;
+    json& playerData;
+    vector<unique_ptr<BotPolicy>> policies;
+    GamePhase phase;
+    Card pendingCard;
+    bool colorForStack;
+    Type stackType;
+    int stackTotal;
+    int stackSeat;
+    int turns;
+    string checkpointPath;
+    int checkpointEvery;
+    string botName;
+    thread ponderThread;
+    atomic<bool> ponderStop;
+
+    Game(string name, json& pdata, bool enableAllDiscard, bool interactive = true, const string& bot = "") : playerData(pdata), pendingCard(NONE, NUMBER) {
+        playerName = name;
+        botName = bot;
+        allDiscardRule = enableAllDiscard;
+        turns = 0;
+        checkpointEvery = 0;
+        seatPlayers();
+
+        for (auto& p : players)
+            p.draw(deck, 7);
+
+        Card first = deck.drawCard();
+        while (first.type == WILD_DRAW_FOUR) first = deck.drawCard();
+        currentColor = (first.type == WILD) ? (Color)(rand() % 4) : first.color;
+        deck.placeCard(first);
+
+        currentPlayer = 0;
+        direction = 1;
+        phase = TURN_START;
+        colorForStack = false;
+        stackType = NUMBER;
+        stackTotal = 0;
+        stackSeat = 0;
+
+        playerData["played_games"] = int(playerData["played_games"]) + 1;
+
+        if (interactive) mainLoop();
+    }
+
+    Game(string name, json& pdata, const vector<uint8_t>& saved, bool interactive = true, const string& bot = "") : playerData(pdata), pendingCard(NONE, NUMBER) {
+        playerName = name;
+        botName = bot;
+        checkpointEvery = 0;
+        seatPlayers();
+        if (!restore(saved)) throw runtime_error("saved game is corrupt or belongs to another player");
+        if (interactive) mainLoop();
+    }
+
+    ~Game() {
+        stopPondering();
+    }
+
+    vector<uint8_t> snapshot() const {
+        if (playerName.size() > 0xFFFF) throw runtime_error("player name is too long to save");
+        SnapshotWriter w;
+        w.bytes.insert(w.bytes.end(), "UNOSAV2", "UNOSAV2" + 8);
+        w.u16(playerName.size());
+        w.bytes.insert(w.bytes.end(), playerName.begin(), playerName.end());
+        w.u8(allDiscardRule);
+        w.u8(currentPlayer);
+        w.u8(direction > 0);
+        w.u8(currentColor);
+        w.u8(phase);
+        w.u8(pendingCard.color == NONE && pendingCard.type == NUMBER ? 255 : cardKind(pendingCard));
+        w.u8(colorForStack);
+        w.u8(stackType);
+        w.u16(stackTotal);
+        w.u8(stackSeat);
+        w.u32(turns);
+        w.u16(deck.cards.size());
+        for (Card c : deck.cards) w.u8(cardKind(c));
+        vector<Card> pile;
+        for (stack<Card> copy = deck.pile; !copy.empty(); copy.pop()) pile.push_back(copy.top());
+        w.u16(pile.size());
+        for (int i = (int)pile.size() - 1; i >= 0; i--) w.u8(cardKind(pile[i]));
+        for (const Player& p : players) {
+            w.u16(p.hand.size());
+            for (Card c : p.hand) w.u8(cardKind(c));
+        }
+        return w.bytes;
+    }
+
+    bool restore(const vector<uint8_t>& bytes) {
+        if (bytes.size() < 8) return false;
+        bool wide = memcmp(bytes.data(), "UNOSAV2", 8) == 0;
+        if (!wide && memcmp(bytes.data(), "UNOSAV1", 8) != 0) return false;
+        SnapshotReader r(bytes.data() + 8, bytes.size() - 8);
+        auto size = [&]() { return wide ? r.u16() : r.u8(); };
+        string name;
+        for (int n = size(); n > 0 && r.ok; n--) name += (char)r.u8();
+        if (name != playerName) return false;
+        allDiscardRule = r.u8();
+        currentPlayer = r.u8() & 3;
+        direction = r.u8() ? 1 : -1;
+        currentColor = (Color)min(r.u8(), (int)NONE);
+        phase = (GamePhase)min(r.u8(), (int)GAME_OVER);
+        int pending = r.u8();
+        pendingCard = pending < NUM_KINDS ? kindToCard(pending) : Card(NONE, NUMBER);
+        colorForStack = r.u8();
+        stackType = (Type)min(r.u8(), (int)WILD_DRAW_FOUR);
+        stackTotal = r.u16();
+        stackSeat = r.u8() & 3;
+        turns = r.u32();
+        auto readCards = [&](int count, auto&& place) {
+            for (int i = 0; i < count && r.ok; i++) {
+                int kind = r.u8();
+                if (kind >= NUM_KINDS) r.ok = false;
+                else place(kindToCard(kind));
+            }
+        };
+        deck.cards.clear();
+        readCards(r.u16(), [&](Card c) { deck.cards.push_back(c); });
+        deck.pile = stack<Card>();
+        readCards(r.u16(), [&](Card c) { deck.placeCard(c); });
+        for (Player& p : players) {
+            p.hand.clear();
+            memset(p.counts, 0, sizeof(p.counts));
+            readCards(size(), [&](Card c) { p.addCard(c); });
+        }
+        return r.ok && r.pos == r.end && !deck.pile.empty();
+    }
+
+    void checkpoint() {
+        if (checkpointPath.empty()) return;
+        vector<uint8_t> bytes = snapshot();
+        string temp = checkpointPath + ".tmp";
+        {
+            ofstream out(temp, ios::binary);
+            out.write((const char*)bytes.data(), bytes.size());
+        }
+        rename(temp.c_str(), checkpointPath.c_str());
+    }
+
+    void endGame(bool won) {
+        if (!checkpointPath.empty()) remove(checkpointPath.c_str());
+        if (won) playerData["wins"] = int(playerData["wins"]) + 1;
+        else playerData["losses"] = int(playerData["losses"]) + 1;
+        playerData["history"].push_back({ {"date", getTodayDate()}, {"result", won ? "win" : "loss"} });
+    }
+
+    GameState toState() {
+        GameState s;
+        for (int i = 0; i < 4; i++) {
+            memcpy(s.hands[i], players[i].counts, KIND_LANES);
+            s.handSize[i] = players[i].hand.size();
+        }
+        for (Card c : deck.cards) {
+            s.deck[cardKind(c)]++;
+            s.deckSize++;
+        }
+        for (stack<Card> pile = deck.pile; !pile.empty(); pile.pop())
+            s.discarded[cardKind(pile.top())]++;
+        s.topKind = cardKind(deck.topCard());
+        s.currentColor = currentColor;
+        s.currentPlayer = currentPlayer;
+        s.direction = direction;
+        s.allDiscardRule = allDiscardRule;
+        s.turns = turns;
+        return s;
+    }
+
+    vector<pair<BotPolicy*, GameState>> humanOutcomes() {
+        vector<pair<BotPolicy*, GameState>> outcomes;
+        GameState s = toState();
+        uint64_t actions = 0;
+        if (phase == AWAIT_CARD) {
+            actions = legalActions(s) | 1ULL << ACTION_DRAW;
+            int favorite = 0;
+            for (int c = 0; c < 4; c++) favorite = max(favorite, s.colorCount(currentPlayer, (Color)c));
+            for (int c = 0; c < 4; c++)
+                if (s.colorCount(currentPlayer, (Color)c) < favorite) actions &= ~(1ULL << (52 + c) | 1ULL << (56 + c));
+        } else if (phase == AWAIT_COLOR && !colorForStack) {
+            int kind = cardKind(pendingCard);
+            s.give(currentPlayer, kind);
+            actions = 0xFULL << (kind == KIND_WILD ? 52 : 56);
+        } else if (phase == AWAIT_STACK) {
+            s.currentPlayer = stackSeat;
+            s.pendingPenalty = stackTotal;
+            s.pendingType = stackType;
+            actions = legalActions(s);
+        }
+        FastRng rng(s.hash());
+        for (uint64_t m = actions; m; m &= m - 1) {
+            GameState d = s;
+            applyAction(d, __builtin_ctzll(m), rng);
+            if (d.winner >= 0) continue;
+            Player& next = players[d.currentPlayer];
+            if (next.isBot && next.policy->ponders() && __builtin_popcountll(legalActions(d)) > 1) outcomes.push_back({ next.policy, d });
+        }
+        return outcomes;
+    }
+
+    void ponder() {
+        vector<pair<BotPolicy*, GameState>> outcomes = humanOutcomes();
+        if (outcomes.empty()) return;
+        ponderStop = false;
+        ponderThread = thread([this, outcomes] {
+            vector<char> open(outcomes.size(), 1);
+            for (bool more = true; more && !ponderStop;) {
+                more = false;
+                for (size_t i = 0; i < outcomes.size() && !ponderStop; i++)
+                    if (open[i]) more |= open[i] = outcomes[i].first->ponder(outcomes[i].second, PONDER_CHUNK);
+            }
+        });
+    }
+
+    void stopPondering() {
+        ponderStop = true;
+        if (ponderThread.joinable()) ponderThread.join();
+    }
+
+    Card botPlay(Player& p, Color& newColor) {
+        GameState view = toState();
+        int kind = p.policy->chooseCard(view, view.legalMask());
+        if (kind == DRAW_MOVE) return Card(NONE, NUMBER);
+        Card played = p.takeKind(kind);
+        newColor = kindTable.isWild(kind) ? p.policy->chooseColor(view) : played.color;
+        return played;
+    }
+
+    void showCardCounts() {
+        cout << "\nCard counts: ";
+        for (auto& p : players) {
+            cout << p.name << ": " << p.hand.size();
+            if (p.hand.size() == 1) cout << " (UNO!)";
+            cout << " | ";
+        }
+        cout << endl;
+    }
+
+    bool awaitingInput() const {
+        return phase == AWAIT_CARD || phase == AWAIT_COLOR || phase == AWAIT_STACK;
+    }
+
+    void advance() {
+        while (phase == TURN_START || phase == RESOLVE_PENALTY) {
+            if (phase == TURN_START) startTurn();
+            else resolvePenalty();
+        }
+    }
+
+    bool submit(int choice) {
+        Player& p = players[phase == AWAIT_STACK || (phase == AWAIT_COLOR && colorForStack) ? stackSeat : currentPlayer];
+        if (phase == AWAIT_CARD) {
+            if (choice == 0) {
+                cout << p.name << " drew a card.\n";
+                p.draw(deck);
+                advanceTurn();
+                phase = TURN_START;
+            } else if (choice >= 1 && choice <= (int)p.hand.size()) {
+                Card selected = p.hand[choice - 1];
+                if (!p.canPlay(selected, deck.topCard(), currentColor)) {
+                    cout << "Invalid card. Try again.\n";
+                    return false;
+                }
+                p.removeAt(choice - 1);
+                if (selected.type == WILD || selected.type == WILD_DRAW_FOUR) {
+                    pendingCard = selected;
+                    colorForStack = false;
+                    phase = AWAIT_COLOR;
+                    return true;
+                }
+                resolvePlay(p, selected, selected.color);
+            } else {
+                return false;
+            }
+        } else if (phase == AWAIT_COLOR) {
+            if (choice < RED || choice > YELLOW) return false;
+            if (colorForStack) {
+                currentColor = (Color)choice;
+                stackSeat = (stackSeat + direction + 4) % 4;
+                phase = RESOLVE_PENALTY;
+            } else {
+                resolvePlay(p, pendingCard, (Color)choice);
+            }
+        } else if (phase == AWAIT_STACK) {
+            if (choice == 1) {
+                int stackKind = stackType == WILD_DRAW_FOUR ? KIND_WILD_DRAW_FOUR : cardKind(Card(deck.topCard().color, DRAW_TWO));
+                Card played = p.takeKind(stackKind);
+                deck.placeCard(played);
+                cout << p.name << " plays " << played.toString() << " (stack)\n";
+                stackTotal += (stackType == DRAW_TWO) ? 2 : 4;
+                if (stackType == WILD_DRAW_FOUR) {
+                    colorForStack = true;
+                    phase = AWAIT_COLOR;
+                    return true;
+                }
+                currentColor = played.color;
+                stackSeat = (stackSeat + direction + 4) % 4;
+                phase = RESOLVE_PENALTY;
+            } else {
+                finishPenalty();
+            }
+        } else {
+            return false;
+        }
+        advance();
+        return true;
+    }
+
+    void mainLoop() {
+        advance();
+        while (phase != GAME_OVER) {
+            Player& p = players[phase == AWAIT_STACK || (phase == AWAIT_COLOR && colorForStack) ? stackSeat : currentPlayer];
+            if (phase == AWAIT_CARD) {
+                cout << "\nYour hand:\n";
+                for (int i = 0; i < (int)p.hand.size(); i++)
+                    cout << i + 1 << ". " << p.hand[i].toString() << endl;
+                cout << "0. Draw a card\nChoose: ";
+            } else if (phase == AWAIT_COLOR) {
+                cout << "Choose color (0=Red, 1=Green, 2=Blue, 3=Yellow): ";
+            } else {
+                cout << "You are penalized with " << stackTotal << " cards. You have a matching card.\n";
+                cout << "Do you want to stack it? (1 = Yes, 0 = No): ";
+            }
+            ponder();
+            int choice;
+            bool entered = (bool)(cin >> choice);
+            stopPondering();
+            if (!entered) return;
+            submit(choice);
+        }
+    }
+
+    void advanceTurn() {
+        currentPlayer = (currentPlayer + direction + 4) % 4;
+    }
+
+private:
+    void seatPlayers() {
+        for (int i = 1; i <= 3; i++)
+            if (botName.empty()) policies.push_back(unique_ptr<BotPolicy>(new FirstPlayablePolicy(time(0) + i)));
+            else policies.push_back(makePolicy(botName, time(0) + i));
+
+        players.push_back(Player(playerName));
+        players.push_back(Player("Bot1", true, policies[0].get()));
+        players.push_back(Player("Bot2", true, policies[1].get()));
+        players.push_back(Player("Bot3", true, policies[2].get()));
+    }
+
+    void startTurn() {
+        if (checkpointEvery > 0 && (turns + 1) % checkpointEvery == 0) checkpoint();
+        turns++;
+        Player& p = players[currentPlayer];
+        Card top = deck.topCard();
+        showCardCounts();
+        cout << "\nTop card: " << top.toString() << " | Current color: " << colorToString(currentColor) << endl;
+
+        if (!p.isBot) {
+            phase = AWAIT_CARD;
+            return;
+        }
+        if (!p.hasPlayableCard(top, currentColor)) {
+            cout << p.name << " draws a card.\n";
+            p.draw(deck);
+            advanceTurn();
+            return;
+        }
+
+        Color newColor = currentColor;
+        Card played = botPlay(p, newColor);
+        if (played.color == NONE && played.type == NUMBER && played.number == -1) {
+            cout << p.name << " drew a card.\n";
+            p.draw(deck);
+            advanceTurn();
+            return;
+        }
+        resolvePlay(p, played, newColor);
+    }
+
+    void resolvePlay(Player& p, Card played, Color newColor) {
+        cout << p.name << " plays " << played.toString() << endl;
+        deck.placeCard(played);
+        currentColor = newColor;
+
+        if (allDiscardRule) {
+            vector<Card>& hand = p.hand;
+            vector<Card> extras;
+            for (Card c : hand)
+                if (c.color == played.color) extras.push_back(c);
+            for (Card c : extras) {
+                cout << "-> " << p.name << " also discards " << c.toString() << " (All Discard)\n";
+                auto it = find_if(hand.begin(), hand.end(), [&](Card a) { return a.equals(c); });
+                if (it != hand.end()) p.removeAt(it - hand.begin());
+                deck.placeCard(c);
+            }
+        }
+
+        if (p.hand.empty()) {
+            cout << p.name << " wins the game!\n";
+            endGame(p.name == playerName);
+            phase = GAME_OVER;
+            return;
+        }
+
+        if (played.type == DRAW_TWO || played.type == WILD_DRAW_FOUR) {
+            stackType = played.type;
+            stackTotal = played.type == DRAW_TWO ? 2 : 4;
+            stackSeat = (currentPlayer + direction + 4) % 4;
+            phase = RESOLVE_PENALTY;
+            return;
+        }
+        if (played.type == REVERSE) direction *= -1;
+        else if (played.type == SKIP) advanceTurn();
+        advanceTurn();
+        phase = TURN_START;
+    }
+
+    void resolvePenalty() {
+        turns++;
+        Player& p = players[stackSeat];
+        int stackKind = stackType == WILD_DRAW_FOUR ? KIND_WILD_DRAW_FOUR : cardKind(Card(deck.topCard().color, DRAW_TWO));
+        if (!hasPlayable(p.counts, 1ULL << stackKind)) {
+            cout << p.name << " must draw " << stackTotal << " cards.\n";
+            p.draw(deck, stackTotal);
+            advanceTurn();
+            finishPenalty();
+            return;
+        }
+        if (!p.isBot) {
+            phase = AWAIT_STACK;
+            return;
+        }
+        GameState view = toState();
+        view.currentPlayer = stackSeat;
+        view.pendingPenalty = stackTotal;
+        view.pendingType = stackType;
+        if (!p.policy->stackOrTake(view, 1ULL << stackKind)) {
+            cout << p.name << " must draw " << stackTotal << " cards.\n";
+            p.draw(deck, stackTotal);
+            advanceTurn();
+            finishPenalty();
+            return;
+        }
+        Card played = p.takeKind(stackKind);
+        deck.placeCard(played);
+        cout << p.name << " plays " << played.toString() << " (stack)\n";
+        stackTotal += (stackType == DRAW_TWO) ? 2 : 4;
+        currentColor = played.color == NONE ? p.policy->chooseColor(view) : played.color;
+        stackSeat = (stackSeat + direction + 4) % 4;
+    }
+
+    void finishPenalty() {
+        advanceTurn();
+        phase = TURN_START;
+    }
+};
+
+vector<uint8_t> narrowSnapshot(const vector<uint8_t>& wide) {
+    SnapshotReader r(wide.data() + 8, wide.size() - 8);
+    vector<uint8_t> out(wide.begin(), wide.begin() + 8);
+    out[6] = '1';
+    auto copy = [&](int n) {
+        for (; n > 0 && r.ok; n--) out.push_back((uint8_t)r.u8());
+    };
+    int name = r.u16();
+    out.push_back((uint8_t)name);
+    copy(name + 15);
+    for (int part = 0; part < 2; part++) {
+        int n = r.u16();
+        out.push_back((uint8_t)(n & 255));
+        out.push_back((uint8_t)(n >> 8));
+        copy(n);
+    }
+    for (int i = 0; i < 4; i++) {
+        int n = r.u16();
+        out.push_back((uint8_t)n);
+        copy(n);
+    }
+    return out;
+}
+
+string checkGameSnapshots() {
+    json data = { {"played_games", 0}, {"wins", 0}, {"losses", 0}, {"history", json::array()} };
+    FastRng rng(5);
+    for (int round = 0; round < 60; round++) {
+        Game g("tester", data, round % 2, false);
+        int most = 0;
+        for (int i = 0; i < 4; i++) {
+            g.players[i].draw(g.deck, rng.below(round % 10 == 9 ? 400 : 20));
+            most = max(most, (int)g.players[i].hand.size());
+        }
+        for (int n = rng.below(30); n > 0; n--) g.deck.placeCard(g.deck.drawCard());
+        g.currentPlayer = rng.below(4);
+        g.direction = rng.below(2) ? 1 : -1;
+        g.currentColor = (Color)rng.below(4);
+        g.phase = (GamePhase)rng.below(GAME_OVER + 1);
+        g.pendingCard = rng.below(2) ? kindToCard(rng.below(NUM_KINDS)) : Card(NONE, NUMBER);
+        g.colorForStack = rng.below(2);
+        g.stackType = rng.below(2) ? DRAW_TWO : WILD_DRAW_FOUR;
+        g.stackTotal = rng.below(1000);
+        g.stackSeat = rng.below(4);
+        g.turns = rng.below(1000000);
+        vector<uint8_t> bytes = g.snapshot();
+        Game copy("tester", data, false, false);
+        if (!copy.restore(bytes) || copy.snapshot() != bytes) return "round " + to_string(round) + " did not survive a save and load";
+        if (copy.toState().hash() != g.toState().hash()) return "round " + to_string(round) + " restored a different game state";
+        if (most < 256 && (!copy.restore(narrowSnapshot(bytes)) || copy.snapshot() != bytes))
+            return "round " + to_string(round) + " did not load from the UNOSAV1 layout";
+        for (size_t cut : { (size_t)7, (size_t)12, bytes.size() / 2, bytes.size() - 1 })
+            if (copy.restore(vector<uint8_t>(bytes.begin(), bytes.begin() + cut))) return "a snapshot cut to " + to_string(cut) + " bytes loaded";
+        try {
+            Game other("someone", data, bytes, false);
+            return "a snapshot loaded for another player";
+        } catch (const runtime_error&) {
+        }
+    }
+    return "";
+}
+
+const int MAX_TABLE_TURNS = 5000;
+const int CHECKPOINT_TURNS = 4;
+
+struct CoGame {
+    struct promise_type {
+        CoGame get_return_object() {
+            return CoGame{ coroutine_handle<promise_type>::from_promise(*this) };
+        }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+
+        static void* operator new(size_t size) {
+            return FramePool::allocate(size);
+        }
+
+        static void operator delete(void* p, size_t size) {
+            FramePool::release(p, size);
+        }
+    };
+
+    coroutine_handle<promise_type> handle;
+};
+
+struct CoTable;
+
+struct DecisionAwaiter;
+
+class HumanInputs {
+public:
+    virtual ~HumanInputs() {}
+    virtual void request(DecisionAwaiter* decision) = 0;
+};
+
+struct CoTable {
+    GameState state;
+    unique_ptr<BotPolicy> bots[4];
+    FastRng rng;
+    WorkStealingExecutor* executor;
+    HumanInputs* humans;
+};
+
+struct DecisionAwaiter {
+    CoTable& table;
+    int seat;
+    int action;
+    coroutine_handle<> handle;
+
+    bool await_ready() const {
+        return false;
+    }
+
+    void await_suspend(coroutine_handle<> h) {
+        handle = h;
+        if (table.bots[seat]) table.executor->schedule({ &DecisionAwaiter::decideBot, this });
+        else table.humans->request(this);
+    }
+
+    int await_resume() const {
+        return action;
+    }
+
+    void provide(int chosen) {
+        action = chosen;
+        table.executor->schedule(handle);
+    }
+
+    static void decideBot(void* self) {
+        DecisionAwaiter* d = (DecisionAwaiter*)self;
+        d->action = policyAction(d->table.state, d->table.bots[d->seat].get());
+        d->handle.resume();
+    }
+};
+
+CoGame playTableGames(CoTable& t, atomic<long long>& nextGame, long long games, atomic<long long>& moves, atomic<long long>& running) {
+    GameState& s = t.state;
+    BotPolicy* seats[4];
+    for (int i = 0; i < 4; i++) seats[i] = t.bots[i].get();
+    bool observed = anyObserver(seats);
+    for (long long id = nextGame++; id < games; id = nextGame++) {
+        s = GameState::deal(id + 1, id % 2);
+        t.rng = FastRng(id + 1);
+        for (int i = 0; i < 4; i++)
+            if (t.bots[i]) t.bots[i]->reset(id * 4 + i + 1);
+        while (s.winner < 0 && s.turns < MAX_TABLE_TURNS) {
+            int action = co_await DecisionAwaiter{ t, s.currentPlayer, ACTION_DRAW, nullptr };
+            stepGame(s, action, t.rng, seats, observed);
+            moves.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    t.executor->complete(running);
+}
+
+class SimulatedHumans final : public HumanInputs {
+public:
+    SimulatedHumans() : rng(42) {
+        stopping = false;
+        worker = thread([this] { loop(); });
+    }
+
+    ~SimulatedHumans() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        arrived.notify_one();
+        worker.join();
+    }
+
+    void request(DecisionAwaiter* decision) override {
+        {
+            lock_guard<mutex> guard(lock);
+            queue.push_back(decision);
+        }
+        arrived.notify_one();
+    }
+
+private:
+    mutex lock;
+    condition_variable arrived;
+    vector<DecisionAwaiter*> queue;
+    thread worker;
+    bool stopping;
+    FastRng rng;
+
+    void loop() {
+        vector<DecisionAwaiter*> batch;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                arrived.wait(guard, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                batch.swap(queue);
+            }
+            for (DecisionAwaiter* d : batch) {
+                uint64_t options = legalActions(d->table.state);
+                for (int skip = rng.below(__builtin_popcountll(options)); skip > 0; skip--) options &= options - 1;
+                d->provide(__builtin_ctzll(options));
+            }
+            batch.clear();
+        }
+    }
+};
+
+void runCoroutineGames(long long games, int concurrent, int humanSeats, string botName) {
+    auto start = chrono::steady_clock::now();
+    atomic<long long> nextGame(0), moves(0);
+    atomic<long long> running(concurrent);
+    {
+        vector<CoTable> tables(concurrent);
+        WorkStealingExecutor executor;
+        SimulatedHumans humans;
+        for (int i = 0; i < concurrent; i++) {
+            CoTable& t = tables[i];
+            t.executor = &executor;
+            t.humans = &humans;
+            for (int seat = 0; seat < 4; seat++)
+                if (seat >= humanSeats) t.bots[seat] = makePolicy(botName, i * 4 + seat + 1);
+        }
+        for (int i = 0; i < concurrent; i++) executor.schedule(playTableGames(tables[i], nextGame, games, moves, running).handle);
+        executor.helpUntilDone(running);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Played " << games << " games (" << moves << " moves) as " << concurrent << " interleaved coroutines with "
+         << humanSeats << " human seat(s) each, in " << seconds << " s (" << games / seconds << " games/s, "
+         << moves / seconds << " moves/s)\n";
+}
+
+bool reachEndgame(GameState& s, const EndgameSolver& solver, uint64_t seed) {
+    FastRng rng(seed);
+    s = GameState::deal(seed, false);
+    while (s.winner < 0 && !solver.applies(s) && s.turns < 1000) {
+        uint64_t legal = s.legalMask();
+        if (legal) s.play(__builtin_ctzll(legal), (Color)rng.below(4));
+        else {
+            s.draw();
+            s.resolveDraws(rng);
+        }
+    }
+    return s.winner < 0 && solver.applies(s);
+}
+
+void runEndgameAnalysis(int positions, int threshold, int draws) {
+    EndgameSolver solver(threshold, draws);
+    double totalMicros = 0;
+    int solved = 0;
+    for (int n = 0; n < positions; n++) {
+        GameState s;
+        if (!reachEndgame(s, solver, n + 1)) continue;
+
+        solver.clear();
+        auto start = chrono::steady_clock::now();
+        EndgameResult r = solver.solve(s);
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        totalMicros += micros;
+        solved++;
+
+        cout << "Position " << n + 1 << " | hands";
+        for (int i = 0; i < 4; i++) cout << " " << s.handSize[i];
+        cout << " | to move: " << s.currentPlayer << " | best: ";
+        if (r.bestKind == DRAW_MOVE) cout << "Draw";
+        else cout << kindToCard(r.bestKind).toString();
+        if (r.bestKind != DRAW_MOVE && kindTable.isWild(r.bestKind)) cout << " -> " << colorToString(r.bestColor);
+        cout << " | win:";
+        for (int i = 0; i < 4; i++) cout << " " << r.winProb[i];
+        if (r.exact) cout << " (exact)";
+        else cout << " (estimate, +/- " << r.slack << ")";
+        cout << " | " << r.nodes << " nodes, " << micros << " us\n";
+    }
+    if (solved) cout << "Solved " << solved << " positions, average " << totalMicros / solved << " us\n";
+}
+
+struct SimStats {
+    long long games;
+    long long wins[4];
+    long long turns;
+    double seconds;
+};
+
+template <class Policy>
+SimStats simulate(Policy* const seats[4], long long first, long long last, uint64_t seed, bool allDiscard) {
+    SimStats stats = { 0, {0, 0, 0, 0}, 0, 0 };
+    for (long long g = first; g < last; g++) {
+        for (int i = 0; i < 4; i++) seats[i]->reset(seed + (uint64_t)g * 4 + i);
+        GameState s = GameState::deal(seed + g, allDiscard);
+        FastRng rng(~(seed + g));
+        int winner = playGame(s, seats, rng);
+        if (winner >= 0) stats.wins[winner]++;
+        stats.turns += s.turns;
+        stats.games++;
+    }
+    return stats;
+}
+
+template <class Policy>
+SimStats simulateParallel(long long games, uint64_t seed, bool allDiscard, function<unique_ptr<Policy>(int)> make) {
+    typedef array<unique_ptr<Policy>, 4> Seats;
+    ObjectPool<Seats> pool([&] {
+        unique_ptr<Seats> seats(new Seats());
+        for (int i = 0; i < 4; i++) (*seats)[i] = make(i);
+        return seats;
+    });
+    mutex lock;
+    SimStats stats = { 0, {0, 0, 0, 0}, 0, 0 };
+    auto start = chrono::steady_clock::now();
+    TaskGroup group;
+    group.parallelFor(0, games, 256, [&](long long first, long long last) {
+        unique_ptr<Seats> policies = pool.acquire();
+        Policy* const seats[4] = { (*policies)[0].get(), (*policies)[1].get(), (*policies)[2].get(), (*policies)[3].get() };
+        SimStats part = simulate(seats, first, last, seed, allDiscard);
+        pool.release(std::move(policies));
+        lock_guard<mutex> guard(lock);
+        stats.games += part.games;
+        stats.turns += part.turns;
+        for (int i = 0; i < 4; i++) stats.wins[i] += part.wins[i];
+    });
+    group.wait();
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+template <class Policy>
+SimStats simulateStatic(long long games, uint64_t seed, bool allDiscard) {
+    return simulateParallel<Policy>(games, seed, allDiscard, [&](int i) { return unique_ptr<Policy>(new Policy(seed + i + 1)); });
+}
+
+struct BatchLanes {
+    const uint8_t* top;
+    const uint8_t* color;
+    const uint8_t* seat;
+    const uint16_t* penalty;
+    const uint8_t* type;
+    const uint64_t* handBits;
+};
+
+struct StackTable {
+    alignas(64) uint64_t drawTwo[KIND_LANES];
+
+    StackTable() {
+        memset(drawTwo, 0, sizeof(drawTwo));
+        for (int k = 0; k < NUM_KINDS; k++)
+            if (kindTable.color[k] != NONE) drawTwo[k] = 1ULL << (kindTable.color[k] * 13 + 12);
+    }
+};
+
+const StackTable stackTable;
+
+inline uint64_t batchLegalAt(const BatchLanes& l, int i) {
+    uint64_t bits = l.handBits[i * 4 + l.seat[i]];
+    if (!l.penalty[i]) return bits & kindTable.playable[l.top[i]][l.color[i]];
+    return bits & (l.type[i] == WILD_DRAW_FOUR ? 1ULL << KIND_WILD_DRAW_FOUR : stackTable.drawTwo[l.top[i]]);
+}
+
+void batchLegalScalar(const BatchLanes& l, int count, uint64_t* out) {
+    for (int i = 0; i < count; i++) out[i] = batchLegalAt(l, i);
+}
+
+void firstPlayableScalar(const uint64_t* legal, int count, int8_t* chosen) {
+    for (int i = 0; i < count; i++) chosen[i] = legal[i] ? (int8_t)__builtin_ctzll(legal[i]) : (int8_t)DRAW_MOVE;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) inline __m256i widenLanesAvx2(const uint8_t* p) {
+    int packed;
+    memcpy(&packed, p, sizeof(packed));
+    return _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+}
+
+__attribute__((target("avx2"))) inline __m256i widenLanesAvx2(const uint16_t* p) {
+    return _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i*)p));
+}
+
+__attribute__((target("avx2"))) void batchLegalAvx2(const BatchLanes& l, int count, uint64_t* out) {
+    const long long* playable = (const long long*)&kindTable.playable[0][0];
+    const long long* drawTwo = (const long long*)stackTable.drawTwo;
+    const long long* hands = (const long long*)l.handBits;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lanes = _mm256_set_epi64x(12, 8, 4, 0);
+    __m256i wildDrawFour = _mm256_set1_epi64x(WILD_DRAW_FOUR);
+    __m256i wildDrawFourBit = _mm256_set1_epi64x((long long)(1ULL << KIND_WILD_DRAW_FOUR));
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i top = widenLanesAvx2(l.top + i), col = widenLanesAvx2(l.color + i), seat = widenLanesAvx2(l.seat + i);
+        __m256i pen = widenLanesAvx2(l.penalty + i), type = widenLanesAvx2(l.type + i);
+        __m256i handIndex = _mm256_add_epi64(_mm256_add_epi64(_mm256_set1_epi64x((long long)i * 4), lanes), seat);
+        __m256i bits = _mm256_i64gather_epi64(hands, handIndex, 8);
+        __m256i normal = _mm256_i64gather_epi64(playable, _mm256_add_epi64(_mm256_add_epi64(_mm256_slli_epi64(top, 2), top), col), 8);
+        __m256i stack = _mm256_blendv_epi8(_mm256_i64gather_epi64(drawTwo, top, 8), wildDrawFourBit, _mm256_cmpeq_epi64(type, wildDrawFour));
+        __m256i rule = _mm256_blendv_epi8(stack, normal, _mm256_cmpeq_epi64(pen, zero));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_and_si256(bits, rule));
+    }
+    for (; i < count; i++) out[i] = batchLegalAt(l, i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline __m512i widenLanesAvx512(const uint8_t* p) {
+    return _mm512_maskz_cvtepu8_epi64(0xFF, _mm_loadl_epi64((const __m128i*)p));
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline __m512i widenLanesAvx512(const uint16_t* p) {
+    return _mm512_maskz_cvtepu16_epi64(0xFF, _mm_loadu_si128((const __m128i*)p));
+}
+
+__attribute__((target("avx512f,avx512bw"))) void batchLegalAvx512(const BatchLanes& l, int count, uint64_t* out) {
+    const void* playable = &kindTable.playable[0][0];
+    __m512i lanes = _mm512_set_epi64(28, 24, 20, 16, 12, 8, 4, 0);
+    __m512i wildDrawFourBit = _mm512_set1_epi64((long long)(1ULL << KIND_WILD_DRAW_FOUR));
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512i top = widenLanesAvx512(l.top + i), col = widenLanesAvx512(l.color + i), seat = widenLanesAvx512(l.seat + i);
+        __m512i pen = widenLanesAvx512(l.penalty + i), type = widenLanesAvx512(l.type + i);
+        __m512i handIndex = _mm512_add_epi64(_mm512_add_epi64(_mm512_set1_epi64((long long)i * 4), lanes), seat);
+        __m512i row = _mm512_add_epi64(_mm512_add_epi64(_mm512_maskz_slli_epi64(0xFF, top, 2), top), col);
+        __m512i bits = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), 0xFF, handIndex, l.handBits, 8);
+        __m512i normal = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), 0xFF, row, playable, 8);
+        __mmask8 penalized = _mm512_test_epi64_mask(pen, pen);
+        __mmask8 drawTwo = penalized & _mm512_cmpneq_epi64_mask(type, _mm512_set1_epi64(WILD_DRAW_FOUR));
+        __m512i stack = _mm512_mask_i64gather_epi64(wildDrawFourBit, drawTwo, top, stackTable.drawTwo, 8);
+        __m512i rule = _mm512_mask_blend_epi64(penalized, normal, stack);
+        _mm512_storeu_si512(out + i, _mm512_and_si512(bits, rule));
+    }
+    for (; i < count; i++) out[i] = batchLegalAt(l, i);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512cd"))) void firstPlayableAvx512(const uint64_t* legal, int count, int8_t* chosen) {
+    __m512i last = _mm512_set1_epi64(63);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512i m = _mm512_loadu_si512(legal + i);
+        __m512i lowest = _mm512_and_si512(m, _mm512_sub_epi64(_mm512_setzero_si512(), m));
+        __m512i index = _mm512_sub_epi64(last, _mm512_lzcnt_epi64(lowest));
+        _mm_storel_epi64((__m128i*)(chosen + i), _mm512_maskz_cvtepi64_epi8(0xFF, index));
+    }
+    firstPlayableScalar(legal + i, count - i, chosen + i);
+}
+#endif
+
+struct BatchKernels {
+    void (*legal)(const BatchLanes&, int, uint64_t*);
+    void (*firstPlayable)(const uint64_t*, int, int8_t*);
+    string name;
+
+    BatchKernels() {
+        legal = batchLegalScalar;
+        firstPlayable = firstPlayableScalar;
+        name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512cd")) {
+            legal = batchLegalAvx512;
+            firstPlayable = firstPlayableAvx512;
+            name = "avx512";
+        } else if (__builtin_cpu_supports("avx2")) {
+            legal = batchLegalAvx2;
+            name = "avx2";
+        }
+#endif
+    }
+};
+
+const BatchKernels batchKernels;
+
+enum BatchPolicy { BATCH_FIRST, BATCH_RANDOM };
+
+class BatchEngine {
+public:
+    int slots;
+    BatchPolicy policy;
+    bool allDiscardRule;
+    vector<uint8_t> topKind;
+    vector<uint8_t> color;
+    vector<uint8_t> seat;
+    vector<int8_t> direction;
+    vector<uint16_t> pendingPenalty;
+    vector<uint8_t> pendingType;
+    vector<uint16_t> turns;
+    vector<uint16_t> deckSize;
+    vector<uint16_t> handSize;
+    vector<uint64_t> handBits;
+    vector<uint8_t> hands;
+    vector<uint8_t> deck;
+    vector<uint64_t> rngState;
+    vector<uint64_t> legal;
+    vector<int8_t> chosen;
+    vector<uint8_t> chosenColor;
+    vector<uint8_t> active;
+    uint64_t nextSeed;
+    long long gamesStarted;
+    long long gameLimit;
+    int live;
+    SimStats stats;
+    int maxTurns;
+
+    BatchEngine(int slotCount, BatchPolicy p, bool allDiscard, uint64_t seed = 1) {
+        slots = slotCount;
+        policy = p;
+        allDiscardRule = allDiscard;
+        topKind.resize(slots);
+        color.resize(slots);
+        seat.resize(slots);
+        direction.resize(slots);
+        pendingPenalty.resize(slots);
+        pendingType.resize(slots);
+        turns.resize(slots);
+        deckSize.resize(slots);
+        handSize.resize(slots * 4);
+        handBits.resize(slots * 4);
+        hands.resize((size_t)slots * 4 * KIND_LANES);
+        deck.resize((size_t)slots * KIND_LANES);
+        rngState.resize(slots);
+        legal.resize(slots);
+        chosen.resize(slots);
+        chosenColor.resize(slots);
+        active.resize(slots);
+        nextSeed = seed;
+        gamesStarted = 0;
+        gameLimit = 0;
+        live = 0;
+        stats = { 0, {0, 0, 0, 0}, 0, 0 };
+        maxTurns = 2000;
+    }
+
+    void deal(int i) {
+        rngState[i] = ~(nextSeed++);
+        uint8_t* d = &deck[(size_t)i * KIND_LANES];
+        memset(d, 0, KIND_LANES);
+        for (int k = 0; k < NUM_KINDS; k++) d[k] = kindTable.copies[k];
+        deckSize[i] = FULL_DECK_SIZE;
+        memset(&hands[(size_t)i * 4 * KIND_LANES], 0, 4 * KIND_LANES);
+        for (int p = 0; p < 4; p++) {
+            handSize[i * 4 + p] = 0;
+            handBits[i * 4 + p] = 0;
+            for (int j = 0; j < 7; j++) give(i, p);
+        }
+        int first = take(i);
+        while (first == KIND_WILD_DRAW_FOUR) first = take(i);
+        topKind[i] = first;
+        color[i] = first == KIND_WILD ? (uint8_t)(nextRandom(i) & 3) : (uint8_t)kindTable.color[first];
+        seat[i] = 0;
+        direction[i] = 1;
+        pendingPenalty[i] = 0;
+        pendingType[i] = NUMBER;
+        turns[i] = 0;
+        active[i] = 1;
+        live++;
+        gamesStarted++;
+    }
+
+    void place(int i, const GameState& s) {
+        rngState[i] = ~(nextSeed++);
+        memcpy(&hands[(size_t)i * 4 * KIND_LANES], s.hands, 4 * KIND_LANES);
+        memcpy(&deck[(size_t)i * KIND_LANES], s.deck, KIND_LANES);
+        for (int p = 0; p < 4; p++) {
+            handSize[i * 4 + p] = (uint16_t)s.handSize[p];
+            handBits[i * 4 + p] = handKernels.nonzeroLanes(s.hands[p]);
+        }
+        deckSize[i] = (uint16_t)s.deckSize;
+        topKind[i] = (uint8_t)s.topKind;
+        color[i] = (uint8_t)s.currentColor;
+        seat[i] = (uint8_t)s.currentPlayer;
+        direction[i] = (int8_t)s.direction;
+        pendingPenalty[i] = (uint16_t)s.pendingPenalty;
+        pendingType[i] = (uint8_t)s.pendingType;
+        turns[i] = (uint16_t)s.turns;
+        if (!active[i]) live++;
+        active[i] = 1;
+    }
+
+    GameState stateAt(int i) const {
+        GameState s;
+        memcpy(s.hands, &hands[(size_t)i * 4 * KIND_LANES], 4 * KIND_LANES);
+        memcpy(s.deck, &deck[(size_t)i * KIND_LANES], KIND_LANES);
+        for (int p = 0; p < 4; p++) s.handSize[p] = handSize[i * 4 + p];
+        s.deckSize = deckSize[i];
+        s.topKind = topKind[i];
+        s.currentColor = (Color)color[i];
+        s.currentPlayer = seat[i];
+        s.direction = direction[i];
+        s.pendingPenalty = pendingPenalty[i];
+        s.pendingType = (Type)pendingType[i];
+        s.allDiscardRule = allDiscardRule;
+        s.turns = turns[i];
+        return s;
+    }
+
+    void step() {
+        computeLegal();
+        decide();
+        for (int i = 0; i < slots; i++)
+            if (active[i]) apply(i);
+    }
+
+    void start(long long games) {
+        gameLimit = gamesStarted + games;
+        for (int i = 0; i < slots && gamesStarted < gameLimit; i++)
+            if (!active[i]) deal(i);
+    }
+
+    SimStats run(long long games) {
+        auto begin = chrono::steady_clock::now();
+        start(games);
+        while (live > 0) step();
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        return stats;
+    }
+
+    void computeLegal() {
+        BatchLanes lanes = { topKind.data(), color.data(), seat.data(), pendingPenalty.data(), pendingType.data(), handBits.data() };
+        batchKernels.legal(lanes, slots, legal.data());
+    }
+
+    void decide() {
+        if (policy == BATCH_FIRST) batchKernels.firstPlayable(legal.data(), slots, chosen.data());
+        else
+            for (int i = 0; i < slots; i++) {
+                uint64_t m = legal[i];
+                if (m)
+                    for (int skip = (int)(nextRandom(i) % __builtin_popcountll(m)); skip > 0; skip--) m &= m - 1;
+                chosen[i] = m ? (int8_t)__builtin_ctzll(m) : (int8_t)DRAW_MOVE;
+            }
+        for (int i = 0; i < slots; i++)
+            if (chosen[i] >= KIND_WILD) chosenColor[i] = (uint8_t)(nextRandom(i) & 3);
+    }
+
+    void apply(int i) {
+        int p = seat[i];
+        int k = chosen[i];
+        turns[i]++;
+        if (k == DRAW_MOVE) {
+            int count = pendingPenalty[i] ? pendingPenalty[i] : 1;
+            for (int n = 0; n < count; n++) give(i, p);
+            pendingPenalty[i] = 0;
+            advance(i);
+            if (turns[i] >= maxTurns) finish(i, -1);
+            return;
+        }
+        bool stacking = pendingPenalty[i] > 0;
+        remove(i, p, k);
+        topKind[i] = k;
+        Color played = kindTable.color[k];
+        color[i] = played == NONE ? chosenColor[i] : (uint8_t)played;
+        if (allDiscardRule && !stacking) {
+            uint8_t* h = &hands[((size_t)i * 4 + p) * KIND_LANES];
+            for (uint64_t m = handBits[i * 4 + p]; m; m &= m - 1) {
+                int e = __builtin_ctzll(m);
+                if (kindTable.color[e] != played) continue;
+                handSize[i * 4 + p] -= h[e];
+                h[e] = 0;
+                handBits[i * 4 + p] &= ~(1ULL << e);
+            }
+        }
+        if (handSize[i * 4 + p] == 0) {
+            finish(i, p);
+            return;
+        }
+        Type t = kindTable.type[k];
+        if (t == REVERSE) direction[i] = -direction[i];
+        else if (t == SKIP) advance(i);
+        else if (t == DRAW_TWO || t == WILD_DRAW_FOUR) {
+            pendingPenalty[i] += t == DRAW_TWO ? 2 : 4;
+            pendingType[i] = t;
+        }
+        advance(i);
+        if (turns[i] >= maxTurns) finish(i, -1);
+    }
+
+private:
+    uint64_t nextRandom(int i) {
+        uint64_t z = (rngState[i] += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    void advance(int i) {
+        seat[i] = (seat[i] + direction[i] + 4) % 4;
+    }
+
+    int take(int i) {
+        uint8_t* d = &deck[(size_t)i * KIND_LANES];
+        if (deckSize[i] == 0) {
+            for (int k = 0; k < NUM_KINDS; k++) d[k] = kindTable.copies[k];
+            deckSize[i] = FULL_DECK_SIZE;
+        }
+        int k = handKernels.nthCard(d, (int)(((nextRandom(i) >> 32) * deckSize[i]) >> 32));
+        d[k]--;
+        deckSize[i]--;
+        return k;
+    }
+
+    void give(int i, int p) {
+        int k = take(i);
+        hands[((size_t)i * 4 + p) * KIND_LANES + k]++;
+        handSize[i * 4 + p]++;
+        handBits[i * 4 + p] |= 1ULL << k;
+    }
+
+    void remove(int i, int p, int k) {
+        uint8_t& count = hands[((size_t)i * 4 + p) * KIND_LANES + k];
+        count--;
+        handSize[i * 4 + p]--;
+        if (count == 0) handBits[i * 4 + p] &= ~(1ULL << k);
+    }
+
+    void finish(int i, int winner) {
+        if (winner >= 0) stats.wins[winner]++;
+        stats.turns += turns[i];
+        stats.games++;
+        active[i] = 0;
+        live--;
+        if (gamesStarted < gameLimit) deal(i);
+    }
+};
+
+SimStats simulateBatched(long long games, int slots, int workers) {
+    mutex lock;
+    SimStats stats = { 0, {0, 0, 0, 0}, 0, 0 };
+    auto start = chrono::steady_clock::now();
+    TaskGroup group;
+    group.parallelFor(0, workers, 1, [&](long long first, long long last) {
+        for (long long w = first; w < last; w++) {
+            BatchEngine engine(slots, BATCH_FIRST, false, 1 + (uint64_t)w * 0x100000000ULL);
+            SimStats part = engine.run(games / workers + (w < games % workers));
+            lock_guard<mutex> guard(lock);
+            stats.games += part.games;
+            stats.turns += part.turns;
+            for (int i = 0; i < 4; i++) stats.wins[i] += part.wins[i];
+        }
+    });
+    group.wait();
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+void runBatchBenchmark(long long games, int slots) {
+    FirstPlayablePolicy policies[4] = { FirstPlayablePolicy(2), FirstPlayablePolicy(3), FirstPlayablePolicy(4), FirstPlayablePolicy(5) };
+    FirstPlayablePolicy* const seats[4] = { &policies[0], &policies[1], &policies[2], &policies[3] };
+    auto start = chrono::steady_clock::now();
+    SimStats single = simulate(seats, 0, games, 1, false);
+    single.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    BatchEngine engine(slots, BATCH_FIRST, false);
+    SimStats batched = engine.run(games);
+    int workers = sharedExecutor().workerCount();
+    SimStats parallelSingle = simulateStatic<FirstPlayablePolicy>(games, 1, false);
+    SimStats parallelBatched = simulateBatched(games, slots, workers);
+    cout << "Kernels: " << handKernels.name << " hands, " << batchKernels.name << " batch passes\n";
+    cout << "1 thread  | per-game " << single.games / single.seconds << " games/s | batched (" << slots << " slots) "
+         << batched.games / batched.seconds << " games/s | " << single.seconds / batched.seconds * batched.games / single.games << "x\n";
+    cout << workers << " threads | per-game " << parallelSingle.games / parallelSingle.seconds << " games/s | batched "
+         << parallelBatched.games / parallelBatched.seconds << " games/s | "
+         << parallelSingle.seconds / parallelBatched.seconds * parallelBatched.games / parallelSingle.games << "x\n";
+    cout << "Avg turns " << (double)single.turns / single.games << " vs " << (double)batched.turns / batched.games << endl;
+    for (int i = 0; i < 4; i++)
+        cout << "Seat " << i << ": " << 100.0 * single.wins[i] / single.games << "% vs "
+             << 100.0 * batched.wins[i] / batched.games << "% wins\n";
+}
+
+bool sameTable(const GameState& a, const GameState& b) {
+    if (memcmp(a.hands, b.hands, sizeof(a.hands)) != 0 || memcmp(a.deck, b.deck, sizeof(a.deck)) != 0) return false;
+    for (int p = 0; p < 4; p++)
+        if (a.handSize[p] != b.handSize[p]) return false;
+    return a.deckSize == b.deckSize && a.topKind == b.topKind && a.currentColor == b.currentColor && a.currentPlayer == b.currentPlayer
+        && a.direction == b.direction && a.pendingPenalty == b.pendingPenalty && a.turns == b.turns
+        && (a.pendingPenalty == 0 || a.pendingType == b.pendingType);
+}
+
+string checkBatchLockstep(BatchEngine& engine) {
+    while (engine.live > 0) {
+        engine.computeLegal();
+        engine.decide();
+        for (int i = 0; i < engine.slots; i++) {
+            if (!engine.active[i]) continue;
+            GameState s = engine.stateAt(i);
+            string where = "slot " + to_string(i) + " turn " + to_string(s.turns);
+            if (s.legalMask() != engine.legal[i]) return where + ": legal moves differ";
+            FastRng rng;
+            rng.state = engine.rngState[i];
+            int k = engine.chosen[i];
+            engine.apply(i);
+            if (k == DRAW_MOVE) {
+                s.draw();
+                s.resolveDraws(rng);
+            } else s.play(k, (Color)engine.chosenColor[i]);
+            if (engine.active[i]) {
+                if (s.winner >= 0) return where + ": the reference game ended, the batched one did not";
+                if (!sameTable(s, engine.stateAt(i))) return where + ": tables diverged";
+            } else if (s.winner < 0 && s.turns < engine.maxTurns) return where + ": the batched game ended early";
+        }
+    }
+    return "";
+}
+
+string checkBatchEngine() {
+    for (int allDiscard = 0; allDiscard < 2; allDiscard++)
+        for (int policy = BATCH_FIRST; policy <= BATCH_RANDOM; policy++) {
+            BatchEngine engine(64, (BatchPolicy)policy, allDiscard, 1 + allDiscard * 1000 + policy * 100);
+            engine.start(64);
+            string error = checkBatchLockstep(engine);
+            if (!error.empty()) return error + (allDiscard ? " (All Discard)" : "");
+        }
+    BatchEngine engine(1, BATCH_FIRST, false);
+    GameState s = GameState::deal(7, false);
+    for (int p = 0; p < 4; p++) {
+        s.hands[p][KIND_WILD_DRAW_FOUR] += 80;
+        s.handSize[p] += 80;
+    }
+    s.topKind = KIND_WILD_DRAW_FOUR;
+    s.pendingPenalty = 4;
+    s.pendingType = WILD_DRAW_FOUR;
+    engine.place(0, s);
+    string error = checkBatchLockstep(engine);
+    if (!error.empty()) return error + " (long stacking chain)";
+    return "";
+}
+
+string checkSimdKernels() {
+    struct HandImpl {
+        string name;
+        uint64_t (*nonzeroLanes)(const uint8_t*);
+        void (*colorCounts)(const uint8_t*, int*);
+        int (*nthCard)(const uint8_t*, int);
+    };
+    struct BatchImpl {
+        string name;
+        void (*legal)(const BatchLanes&, int, uint64_t*);
+        void (*firstPlayable)(const uint64_t*, int, int8_t*);
+    };
+    vector<HandImpl> hands = { { "scalar", nonzeroLanesScalar, colorCountsScalar, nthCardScalar } };
+    vector<BatchImpl> batches = { { "scalar", batchLegalScalar, firstPlayableScalar } };
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        hands.push_back({ "avx2", nonzeroLanesAvx2, colorCountsAvx2, nthCardAvx2 });
+        batches.push_back({ "avx2", batchLegalAvx2, firstPlayableScalar });
+    }
+    if (__builtin_cpu_supports("avx512bw")) hands.push_back({ "avx512", nonzeroLanesAvx512, colorCountsAvx512, nthCardAvx512 });
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512cd")) batches.push_back({ "avx512", batchLegalAvx512, firstPlayableAvx512 });
+#endif
+    FastRng rng(42);
+    alignas(64) uint8_t counts[KIND_LANES];
+    for (int t = 0; t < 20000; t++) {
+        memset(counts, 0, sizeof(counts));
+        int total = 0;
+        for (int k = 0; k < NUM_KINDS; k++) {
+            if (rng.below(4) == 0) counts[k] = (uint8_t)rng.below(t % 2 ? 200 : 5);
+            total += counts[k];
+        }
+        if (total == 0) continue;
+        int r = rng.below(total);
+        int expected[4], got[4];
+        colorCountsScalar(counts, expected);
+        for (const HandImpl& h : hands) {
+            if (h.nonzeroLanes(counts) != nonzeroLanesScalar(counts)) return h.name + " nonzeroLanes differs from scalar";
+            h.colorCounts(counts, got);
+            if (memcmp(got, expected, sizeof(got)) != 0) return h.name + " colorCounts differs from scalar";
+            if (h.nthCard(counts, r) != nthCardScalar(counts, r)) return h.name + " nthCard differs from scalar";
+        }
+    }
+    for (int count = 1; count <= 67; count += 11) {
+        vector<uint8_t> top(count + 16), color(count + 16), seat(count + 16), type(count + 16);
+        vector<uint16_t> penalty(count + 16);
+        vector<uint64_t> handBits((count + 16) * 4), expected(count), got(count);
+        for (int i = 0; i < count; i++) {
+            top[i] = (uint8_t)rng.below(NUM_KINDS);
+            color[i] = (uint8_t)rng.below(4);
+            seat[i] = (uint8_t)rng.below(4);
+            penalty[i] = rng.below(2) ? 0 : (uint16_t)(2 + rng.below(700));
+            type[i] = rng.below(2) ? DRAW_TWO : WILD_DRAW_FOUR;
+            for (int p = 0; p < 4; p++) handBits[i * 4 + p] = rng.next() & ((1ULL << NUM_KINDS) - 1);
+        }
+        if (count > 1) handBits[seat[0]] = 0;
+        BatchLanes lanes = { top.data(), color.data(), seat.data(), penalty.data(), type.data(), handBits.data() };
+        batchLegalScalar(lanes, count, expected.data());
+        vector<int8_t> firstExpected(count), firstGot(count);
+        firstPlayableScalar(expected.data(), count, firstExpected.data());
+        for (const BatchImpl& b : batches) {
+            b.legal(lanes, count, got.data());
+            if (got != expected) return b.name + " batch legality differs from scalar at " + to_string(count) + " slots";
+            b.firstPlayable(expected.data(), count, firstGot.data());
+            if (firstGot != firstExpected) return b.name + " first-playable differs from scalar at " + to_string(count) + " slots";
+        }
+    }
+    return "";
+}
+
+const float ILLEGAL_ACTION_REWARD = -1.0f;
+
+class VecEnv {
+public:
+    int numEnvs;
+    int learnerSeat;
+    bool allDiscardRule;
+    bool drawThenPlayRule;
+    int maxTurns;
+    vector<GameState> games;
+    vector<FastRng> rngs;
+    vector<uint64_t> nextSeeds;
+    vector<float> observations;
+    vector<uint8_t> actionMasks;
+    vector<float> rewards;
+    vector<uint8_t> dones;
+    vector<uint8_t> illegal;
+    long long illegalActions;
+    unique_ptr<BotPolicy> opponent;
+
+    VecEnv(int envs, string opponentName = "greedy", bool allDiscard = false, bool drawThenPlay = false) {
+        numEnvs = envs;
+        learnerSeat = 0;
+        allDiscardRule = allDiscard;
+        drawThenPlayRule = drawThenPlay;
+        maxTurns = 2000;
+        games.resize(envs);
+        rngs.resize(envs);
+        nextSeeds.resize(envs);
+        observations.resize((size_t)envs * OBS_SIZE);
+        actionMasks.resize((size_t)envs * NUM_ACTIONS);
+        rewards.resize(envs);
+        dones.resize(envs);
+        illegal.resize(envs);
+        illegalActions = 0;
+        opponent = makePolicy(opponentName);
+    }
+
+    void reset(const vector<uint64_t>& seeds) {
+        for (int i = 0; i < numEnvs; i++) {
+            nextSeeds[i] = seeds[i % seeds.size()] + (uint64_t)(i / seeds.size()) * 0x9E3779B97F4A7C15ULL;
+            startGame(i);
+            rewards[i] = 0;
+            dones[i] = 0;
+            illegal[i] = 0;
+        }
+    }
+
+    void step(const int32_t* actions) {
+        for (int i = 0; i < numEnvs; i++) {
+            GameState& s = games[i];
+            illegal[i] = actions[i] < 0 || actions[i] >= NUM_ACTIONS || !(legalActions(s) >> actions[i] & 1);
+            if (illegal[i]) {
+                illegalActions++;
+                rewards[i] = ILLEGAL_ACTION_REWARD;
+                dones[i] = 1;
+                startGame(i);
+                continue;
+            }
+            applyAction(s, actions[i], rngs[i]);
+            runOpponents(i);
+            bool over = s.winner >= 0 || s.turns >= maxTurns;
+            rewards[i] = s.winner < 0 ? 0.0f : (s.winner == learnerSeat ? 1.0f : -1.0f);
+            dones[i] = over;
+            if (over) startGame(i);
+            else publish(i);
+        }
+    }
+
+    float* observation(int i) { return &observations[(size_t)i * OBS_SIZE]; }
+    uint8_t* actionMask(int i) { return &actionMasks[(size_t)i * NUM_ACTIONS]; }
+
+private:
+    void startGame(int i) {
+        do {
+            uint64_t seed = nextSeeds[i];
+            nextSeeds[i] += 0x632BE59BD9B4E019ULL;
+            games[i] = GameState::deal(seed, allDiscardRule, drawThenPlayRule);
+            rngs[i] = FastRng(~seed);
+            runOpponents(i);
+        } while (games[i].winner >= 0 || games[i].turns >= maxTurns);
+        publish(i);
+    }
+
+    void runOpponents(int i) {
+        GameState& s = games[i];
+        while (s.winner < 0 && s.currentPlayer != learnerSeat && s.turns < maxTurns)
+            playTurn(s, opponent.get(), rngs[i]);
+    }
+
+    void publish(int i) {
+        ObservationEncoder::encode(games[i], learnerSeat, observation(i));
+        writeActionMask(games[i], actionMask(i));
+    }
+};
+
+void runEnvBenchmark(int envs, int steps) {
+    VecEnv env(envs);
+    vector<uint64_t> seeds(envs);
+    for (int i = 0; i < envs; i++) seeds[i] = i + 1;
+    env.reset(seeds);
+    vector<int32_t> actions(envs);
+    FastRng rng(7);
+    long long episodes = 0, wins = 0;
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < steps; t++) {
+        for (int i = 0; i < envs; i++) {
+            uint8_t* mask = env.actionMask(i);
+            int legal[NUM_ACTIONS], n = 0;
+            for (int a = 0; a < ACTION_DRAW; a++)
+                if (mask[a]) legal[n++] = a;
+            actions[i] = n ? legal[rng.below(n)] : ACTION_DRAW;
+        }
+        env.step(actions.data());
+        for (int i = 0; i < envs; i++) {
+            episodes += env.dones[i];
+            wins += env.rewards[i] > 0;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<int8_t> quantized((size_t)envs * OBS_SIZE);
+    auto encodeStart = chrono::steady_clock::now();
+    for (int r = 0; r < 100; r++) {
+        ObservationEncoder::encodeBatch(env.games.data(), nullptr, envs, env.observations.data());
+        ObservationEncoder::encodeBatch(env.games.data(), nullptr, envs, quantized.data());
+    }
+    double encodeNanos = chrono::duration<double, nano>(chrono::steady_clock::now() - encodeStart).count() / (200.0 * envs);
+    cout << "Observation encoding: " << encodeNanos << " ns per state (" << OBS_SIZE << " features)\n";
+    cout << "Env steps: " << (long long)envs * steps << " | " << seconds * 1e9 / ((double)envs * steps)
+         << " ns/step (including opponent turns) | episodes " << episodes
+         << " | learner win rate " << (episodes ? 100.0 * wins / episodes : 0) << "% | illegal actions " << env.illegalActions << "\n";
+}
+
+string checkVecEnv() {
+    VecEnv env(64);
+    vector<uint64_t> seeds(64);
+    for (int i = 0; i < 64; i++) seeds[i] = i + 1;
+    env.reset(seeds);
+    vector<int32_t> actions(64);
+    long long expected = 0;
+    for (int t = 0; t < 200; t++) {
+        for (int i = 0; i < 64; i++) {
+            uint64_t legal = legalActions(env.games[i]);
+            if (env.games[i].currentPlayer != env.learnerSeat) return "env " + to_string(i) + " is waiting on an opponent";
+            if (t % 3 == 0 && (~legal >> ACTION_DRAW & 1)) {
+                actions[i] = ACTION_DRAW;
+                expected++;
+            } else actions[i] = __builtin_ctzll(legal);
+        }
+        env.step(actions.data());
+        for (int i = 0; i < 64; i++)
+            if (env.illegal[i] && (env.rewards[i] != ILLEGAL_ACTION_REWARD || !env.dones[i])) return "illegal action was not penalised";
+    }
+    if (env.illegalActions != expected) return to_string(env.illegalActions) + " illegal actions counted, expected " + to_string(expected);
+    return "";
+}
+
+void runNNBenchmark(string path, int envs, int steps) {
+    MlpNetwork net;
+    try {
+        if (!net.load(path)) {
+            cout << "Could not load network from " << path << endl;
+            return;
+        }
+    } catch (const runtime_error& e) {
+        cout << "Invalid network: " << e.what() << endl;
+        return;
+    }
+    GameState s = GameState::deal(1, false);
+    NNPolicy single(net);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < 20000; i++) single.chooseCard(s, s.legalMask());
+    double decisionMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / 20000;
+
+    VecEnv env(envs);
+    vector<uint64_t> seeds(envs);
+    for (int i = 0; i < envs; i++) seeds[i] = i + 1;
+    env.reset(seeds);
+    vector<float> logits((size_t)envs * NUM_ACTIONS);
+    vector<int32_t> actions(envs);
+    long long episodes = 0, wins = 0;
+    double inferSeconds = 0;
+    for (int t = 0; t < steps; t++) {
+        auto inferStart = chrono::steady_clock::now();
+        net.forwardBatch(env.observations.data(), envs, logits.data());
+        for (int i = 0; i < envs; i++) actions[i] = maskedArgmax(&logits[(size_t)i * NUM_ACTIONS], env.actionMask(i));
+        inferSeconds += chrono::duration<double>(chrono::steady_clock::now() - inferStart).count();
+        env.step(actions.data());
+        for (int i = 0; i < envs; i++) {
+            episodes += env.dones[i];
+            wins += env.rewards[i] > 0;
+        }
+    }
+    cout << "Int8 kernels: " << int8Kernels.name << endl;
+    cout << "Single decision: " << decisionMicros << " us | batched: "
+         << inferSeconds * 1e6 / ((double)envs * steps) << " us per decision\n";
+    cout << "NN seat vs greedy: " << episodes << " episodes, " << (episodes ? 100.0 * wins / episodes : 0) << "% wins\n";
+}
+
+string checkInt8Kernels() {
+    struct Impl {
+        string name;
+        float (*quantize)(const float*, int, int, uint8_t*);
+        void (*gemm)(const int8_t*, int, int, const uint8_t*, int, const float*, const float*, bool, float*);
+        int block;
+    };
+    vector<Impl> impls = { { "scalar", quantizeRowScalar, gemmInt8Scalar, 1 } };
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) impls.push_back({ "avx2", quantizeRowAvx2, gemmInt8Avx2, 8 });
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) impls.push_back({ "avx512-vnni", quantizeRowAvx512, gemmInt8Vnni, 16 });
+#endif
+    FastRng rng(11);
+    const int in = 173, stride = 192, rows = 37, count = 13;
+    vector<float> x((size_t)count * in), bias(rows), expected((size_t)count * rows), got((size_t)count * rows), scales(count);
+    vector<int8_t> weights((size_t)rows * stride, 0);
+    vector<uint8_t> quantized((size_t)count * stride), reference((size_t)count * stride);
+    for (float& v : x) v = (float)(rng.uniform() * 4 - 1);
+    for (float& v : bias) v = (float)(rng.uniform() - 0.5);
+    for (int r = 0; r < rows; r++)
+        for (int i = 0; i < in; i++) weights[(size_t)r * stride + i] = (int8_t)(rng.below(255) - 127);
+    for (int b = 0; b < count; b++) scales[b] = quantizeRowScalar(&x[(size_t)b * in], in, stride, &reference[(size_t)b * stride]);
+    for (const Impl& impl : impls) {
+        for (int b = 0; b < count; b++)
+            if (impl.quantize(&x[(size_t)b * in], in, stride, &quantized[(size_t)b * stride]) != scales[b]) return impl.name + " quantize scale differs from scalar";
+        if (quantized != reference) return impl.name + " quantized activations differ from scalar";
+        vector<int8_t> packed((size_t)(rows + impl.block - 1) / impl.block * impl.block * stride);
+        packInt8Weights(weights.data(), rows, stride, impl.block, packed.data());
+        for (int batch : { 1, 4, 8, count }) {
+            for (int relu = 0; relu < 2; relu++) {
+                gemmInt8Scalar(weights.data(), rows, stride, reference.data(), batch, scales.data(), bias.data(), relu, expected.data());
+                impl.gemm(packed.data(), rows, stride, reference.data(), batch, scales.data(), bias.data(), relu, got.data());
+                for (int i = 0; i < batch * rows; i++)
+                    if (fabs(got[i] - expected[i]) > 1e-4f * max(1.0f, fabs(expected[i])))
+                        return impl.name + " GEMM differs from scalar at batch " + to_string(batch);
+            }
+        }
+    }
+    return "";
+}
+
+#ifdef __linux__
+struct Transition {
+    float observation[OBS_SIZE];
+    uint8_t actionMask[NUM_ACTIONS];
+    int32_t action;
+    float reward;
+    uint8_t done;
+};
+
+struct alignas(64) RingSlot {
+    atomic<uint64_t> sequence;
+    Transition data;
+};
+
+struct RingHeader {
+    uint64_t magic;
+    uint64_t capacity;
+    atomic<int> state;
+    alignas(64) atomic<uint64_t> head;
+    alignas(64) atomic<uint64_t> tail;
+};
+
+const uint64_t RING_MAGIC = 0x554E4F52494E4731ULL;
+
+class ExperienceRing {
+public:
+    string name;
+    RingHeader* header;
+    RingSlot* slots;
+    uint64_t mask;
+    size_t mappedBytes;
+
+    ExperienceRing(string shmName, uint64_t capacity) {
+        name = shmName;
+        header = nullptr;
+        slots = nullptr;
+        if (capacity & (capacity - 1)) throw runtime_error("ring capacity must be a power of two");
+        mappedBytes = sizeof(RingHeader) + 64 + capacity * sizeof(RingSlot);
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0) throw runtime_error("shm_open failed for " + name);
+        struct stat st;
+        fstat(fd, &st);
+        if (st.st_size == 0 && ftruncate(fd, mappedBytes) != 0) {
+            close(fd);
+            throw runtime_error("ftruncate failed for " + name);
+        }
+        fstat(fd, &st);
+        mappedBytes = st.st_size;
+        void* base = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) throw runtime_error("mmap failed for " + name);
+        header = (RingHeader*)base;
+        slots = (RingSlot*)(((uintptr_t)base + sizeof(RingHeader) + 63) & ~(uintptr_t)63);
+
+        int expected = 0;
+        if (header->state.compare_exchange_strong(expected, 1)) {
+            header->magic = RING_MAGIC;
+            header->capacity = capacity;
+            for (uint64_t i = 0; i < capacity; i++) slots[i].sequence.store(i, memory_order_relaxed);
+            header->head = 0;
+            header->tail = 0;
+            header->state.store(2, memory_order_release);
+        }
+        while (header->state.load(memory_order_acquire) != 2) this_thread::yield();
+        if (header->magic != RING_MAGIC) throw runtime_error(name + " is not an experience ring");
+        mask = header->capacity - 1;
+    }
+
+    ~ExperienceRing() {
+        if (header) munmap(header, mappedBytes);
+    }
+
+    void unlink() {
+        shm_unlink(name.c_str());
+    }
+
+    uint64_t claim() {
+        int spins = 0;
+        while (true) {
+            uint64_t pos = header->head.load(memory_order_relaxed);
+            uint64_t seq = slots[pos & mask].sequence.load(memory_order_acquire);
+            int64_t dif = (int64_t)seq - (int64_t)pos;
+            if (dif == 0) {
+                if (header->head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) return pos;
+            } else if (dif < 0) {
+                backoff(spins);
+            }
+        }
+    }
+
+    Transition& at(uint64_t pos) {
+        return slots[pos & mask].data;
+    }
+
+    void publish(uint64_t pos) {
+        slots[pos & mask].sequence.store(pos + 1, memory_order_release);
+    }
+
+    bool tryConsume(uint64_t& pos) {
+        while (true) {
+            pos = header->tail.load(memory_order_relaxed);
+            uint64_t seq = slots[pos & mask].sequence.load(memory_order_acquire);
+            int64_t dif = (int64_t)seq - (int64_t)(pos + 1);
+            if (dif == 0) {
+                if (header->tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) return true;
+            } else if (dif < 0) {
+                return false;
+            }
+        }
+    }
+
+    void release(uint64_t pos) {
+        slots[pos & mask].sequence.store(pos + mask + 1, memory_order_release);
+    }
+
+private:
+    static void backoff(int& spins) {
+        if (++spins < 64) return;
+        if (spins < 256) this_thread::yield();
+        else this_thread::sleep_for(chrono::microseconds(50));
+    }
+};
+
+void runExperienceProducer(string name, uint64_t capacity, int envs, int steps) {
+    ExperienceRing ring(name, capacity);
+    int threads = sharedExecutor().workerCount();
+    atomic<long long> written(0);
+    auto start = chrono::steady_clock::now();
+    auto worker = [&](int id) {
+        VecEnv env(envs);
+        vector<uint64_t> seeds(envs);
+        for (int i = 0; i < envs; i++) seeds[i] = (uint64_t)id * envs + i + 1;
+        env.reset(seeds);
+        vector<int32_t> actions(envs);
+        vector<Transition> staged(envs);
+        FastRng rng(id + 1);
+        for (int t = 0; t < steps; t++) {
+            for (int i = 0; i < envs; i++) {
+                Transition& tr = staged[i];
+                ObservationEncoder::encode(env.games[i], env.learnerSeat, tr.observation);
+                writeActionMask(env.games[i], tr.actionMask);
+                int legal[NUM_ACTIONS], n = 0;
+                for (int a = 0; a < NUM_ACTIONS; a++)
+                    if (tr.actionMask[a]) legal[n++] = a;
+                actions[i] = tr.action = legal[rng.below(n)];
+            }
+            env.step(actions.data());
+            for (int i = 0; i < envs; i++) {
+                staged[i].reward = env.rewards[i];
+                staged[i].done = env.dones[i];
+                uint64_t pos = ring.claim();
+                ring.at(pos) = staged[i];
+                ring.publish(pos);
+            }
+            written += envs;
+        }
+    };
+    TaskGroup group;
+    group.parallelFor(0, threads, 1, [&](long long first, long long last) {
+        for (long long id = first; id < last; id++) worker((int)id);
+    });
+    group.wait();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Produced " << written << " transitions in " << seconds << " s (" << written / seconds << "/s)\n";
+}
+
+void runExperienceConsumer(string name, uint64_t capacity, long long count) {
+    ExperienceRing ring(name, capacity);
+    long long read = 0, episodes = 0;
+    double rewardSum = 0;
+    auto start = chrono::steady_clock::now();
+    while (read < count) {
+        uint64_t pos;
+        if (!ring.tryConsume(pos)) {
+            this_thread::yield();
+            continue;
+        }
+        const Transition& tr = ring.at(pos);
+        rewardSum += tr.reward;
+        episodes += tr.done;
+        ring.release(pos);
+        read++;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    ring.unlink();
+    cout << "Consumed " << read << " transitions in " << seconds << " s (" << read / seconds << "/s) | episodes "
+         << episodes << " | mean episode reward " << (episodes ? rewardSum / episodes : 0) << endl;
+}
+#endif
+
+const int CFR_SHARDS = 64;
+
+struct alignas(64) CfrShard {
+    mutex lock;
+    vector<float> regret;
+    vector<float> strategy;
+};
+
+class CfrSolver {
+public:
+    CfrAbstraction abstraction;
+    atomic<unsigned long long> iterations;
+    double exploration;
+
+    CfrSolver(CfrAbstraction a) : shards(CFR_SHARDS) {
+        abstraction = a;
+        iterations = 0;
+        exploration = 0.3;
+        int perShard = (abstraction.size() + CFR_SHARDS - 1) / CFR_SHARDS;
+        for (auto& shard : shards) {
+            shard.regret.assign((size_t)perShard * CFR_ACTIONS, 0);
+            shard.strategy.assign((size_t)perShard * CFR_ACTIONS, 0);
+        }
+    }
+
+    void train(unsigned long long target, int threads, string checkpointPath, int checkpointSeconds = 60) {
+        threads = threads > 0 ? threads : 1;
+        unsigned long long startIterations = iterations;
+        TaskGroup group;
+        group.parallelFor(0, threads, 1, [&](long long first, long long last) {
+            for (long long id = first; id < last; id++) {
+                FastRng rng(0xC0FFEEULL * (id + 1) + startIterations);
+                GreedyPolicy base(id + 1);
+                vector<PathNode> path;
+                while (true) {
+                    unsigned long long i = iterations++;
+                    if (i >= target) break;
+                    iterate(rng, base, (int)(i % 4), path);
+                }
+            }
+        });
+        auto lastCheckpoint = chrono::steady_clock::now();
+        auto start = lastCheckpoint;
+        while (!group.done()) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+            if (chrono::steady_clock::now() - lastCheckpoint > chrono::seconds(checkpointSeconds)) {
+                lastCheckpoint = chrono::steady_clock::now();
+                save(checkpointPath);
+                double seconds = chrono::duration<double>(lastCheckpoint - start).count();
+                cout << "Iterations: " << iterations << " (" << (iterations - startIterations) / seconds << "/s), checkpoint saved\n";
+            }
+        }
+        group.wait();
+        iterations = max(startIterations, target);
+        save(checkpointPath);
+    }
+
+    bool load(string path) {
+        ifstream in(path, ios::binary);
+        char magic[8];
+        CfrAbstraction a;
+        unsigned long long count;
+        if (!in.read(magic, 8) || memcmp(magic, "UNOCFR1", 8) != 0) return false;
+        in.read((char*)&a, sizeof(a));
+        in.read((char*)&count, sizeof(count));
+        if (!in) throw runtime_error(path + ": truncated header");
+        a.validate(path);
+        if (a.colorCap != abstraction.colorCap || a.opponentBuckets != abstraction.opponentBuckets
+            || a.stackBuckets != abstraction.stackBuckets)
+            throw runtime_error(path + ": checkpoint uses a different abstraction");
+        vector<CfrShard> loaded(CFR_SHARDS);
+        for (int i = 0; i < CFR_SHARDS; i++) {
+            loaded[i].regret.resize(shards[i].regret.size());
+            loaded[i].strategy.resize(shards[i].strategy.size());
+            in.read((char*)loaded[i].regret.data(), loaded[i].regret.size() * sizeof(float));
+            in.read((char*)loaded[i].strategy.data(), loaded[i].strategy.size() * sizeof(float));
+            if (!in) throw runtime_error(path + ": truncated shard " + to_string(i));
+        }
+        if (in.peek() != EOF) throw runtime_error(path + ": trailing data after shards");
+        for (int i = 0; i < CFR_SHARDS; i++) {
+            lock_guard<mutex> guard(shards[i].lock);
+            shards[i].regret.swap(loaded[i].regret);
+            shards[i].strategy.swap(loaded[i].strategy);
+        }
+        iterations = count;
+        return true;
+    }
+
+    void save(string path) {
+        string temp = path + ".tmp";
+        {
+            ofstream out(temp, ios::binary);
+            unsigned long long count = iterations;
+            out.write("UNOCFR1", 8);
+            out.write((const char*)&abstraction, sizeof(abstraction));
+            out.write((const char*)&count, sizeof(count));
+            for (auto& shard : shards) {
+                lock_guard<mutex> guard(shard.lock);
+                out.write((const char*)shard.regret.data(), shard.regret.size() * sizeof(float));
+                out.write((const char*)shard.strategy.data(), shard.strategy.size() * sizeof(float));
+            }
+        }
+        rename(temp.c_str(), path.c_str());
+    }
+
+    void exportPolicy(string path) {
+        ofstream out(path, ios::binary);
+        uint32_t size = abstraction.size();
+        out.write("UNOCFRP", 8);
+        out.write((const char*)&abstraction, sizeof(abstraction));
+        out.write((const char*)&size, 4);
+        for (uint32_t i = 0; i < size; i++) {
+            CfrShard& shard = shards[i % CFR_SHARDS];
+            float s[CFR_ACTIONS];
+            {
+                lock_guard<mutex> guard(shard.lock);
+                memcpy(s, &shard.strategy[(size_t)(i / CFR_SHARDS) * CFR_ACTIONS], sizeof(s));
+            }
+            int actions = i < size / 2 ? 2 : 4;
+            float total = 0;
+            for (int a = 0; a < actions; a++) total += s[a];
+            uint8_t probs[CFR_ACTIONS] = { 0, 0, 0, 0 };
+            for (int a = 0; a < actions; a++) probs[a] = total > 0 ? (uint8_t)lround(255 * s[a] / total) : 0;
+            out.write((const char*)probs, CFR_ACTIONS);
+        }
+    }
+
+private:
+    struct PathNode {
+        int infoset;
+        int actions;
+        int chosen;
+        float sigma[CFR_ACTIONS];
+    };
+
+    vector<CfrShard> shards;
+
+    void strategyAt(int infoset, int actions, float* sigma) {
+        CfrShard& shard = shards[infoset % CFR_SHARDS];
+        float r[CFR_ACTIONS];
+        {
+            lock_guard<mutex> guard(shard.lock);
+            memcpy(r, &shard.regret[(size_t)(infoset / CFR_SHARDS) * CFR_ACTIONS], actions * sizeof(float));
+        }
+        float total = 0;
+        for (int a = 0; a < actions; a++) total += max(0.0f, r[a]);
+        for (int a = 0; a < actions; a++) sigma[a] = total > 0 ? max(0.0f, r[a]) / total : 1.0f / actions;
+    }
+
+    int decide(CfrDecision decision, const GameState& s, int traverser, int actions, FastRng& rng,
+               vector<PathNode>& path, double& sampleProb, double& reachRatio) {
+        int seat = s.currentPlayer;
+        PathNode node;
+        node.infoset = abstraction.index(decision, s, seat);
+        node.actions = actions;
+        strategyAt(node.infoset, actions, node.sigma);
+        double r = rng.uniform(), acc = 0;
+        node.chosen = actions - 1;
+        if (seat != traverser) {
+            for (int a = 0; a < actions; a++)
+                if ((acc += node.sigma[a]) > r) {
+                    node.chosen = a;
+                    break;
+                }
+            return node.chosen;
+        }
+        double q[CFR_ACTIONS];
+        for (int a = 0; a < actions; a++) q[a] = exploration / actions + (1 - exploration) * node.sigma[a];
+        for (int a = 0; a < actions; a++)
+            if ((acc += q[a]) > r) {
+                node.chosen = a;
+                break;
+            }
+        CfrShard& shard = shards[node.infoset % CFR_SHARDS];
+        {
+            lock_guard<mutex> guard(shard.lock);
+            float* st = &shard.strategy[(size_t)(node.infoset / CFR_SHARDS) * CFR_ACTIONS];
+            for (int a = 0; a < actions; a++) st[a] += (float)(reachRatio * node.sigma[a]);
+        }
+        reachRatio *= node.sigma[node.chosen] / q[node.chosen];
+        sampleProb *= q[node.chosen];
+        path.push_back(node);
+        return node.chosen;
+    }
+
+    void iterate(FastRng& rng, GreedyPolicy& base, int traverser, vector<PathNode>& path) {
+        path.clear();
+        double sampleProb = 1, reachRatio = 1;
+        GameState s = GameState::deal(rng.next(), false);
+        while (s.winner < 0 && s.turns < 2000) {
+            uint64_t legal = s.legalMask();
+            int kind = DRAW_MOVE;
+            if (s.pendingPenalty > 0) {
+                if (legal && decide(CFR_STACK, s, traverser, 2, rng, path, sampleProb, reachRatio) == 0)
+                    kind = __builtin_ctzll(legal);
+            } else if (legal) {
+                kind = base.chooseCard(s, legal);
+            }
+            if (kind == DRAW_MOVE) {
+                s.draw();
+                s.resolveDraws(rng);
+                continue;
+            }
+            Color color = NONE;
+            if (kindTable.isWild(kind)) color = (Color)decide(CFR_COLOR, s, traverser, 4, rng, path, sampleProb, reachRatio);
+            s.play(kind, color);
+        }
+        double utility = s.winner == traverser ? 1.0 : (s.winner < 0 ? 0.0 : -1.0 / 3);
+        double weight = utility / sampleProb;
+        double tail = 1;
+        for (int n = (int)path.size() - 1; n >= 0; n--) {
+            PathNode& node = path[n];
+            double withAction = tail;
+            double withNode = node.sigma[node.chosen] * tail;
+            CfrShard& shard = shards[node.infoset % CFR_SHARDS];
+            lock_guard<mutex> guard(shard.lock);
+            float* r = &shard.regret[(size_t)(node.infoset / CFR_SHARDS) * CFR_ACTIONS];
+            for (int a = 0; a < node.actions; a++)
+                r[a] += (float)(weight * ((a == node.chosen ? withAction : 0) - withNode));
+            tail = withNode;
+        }
+    }
+};
+
+void runCfrTraining(string checkpoint, unsigned long long iterations, string policyPath) {
+    CfrSolver solver({ 3, 4, 4 });
+    try {
+        if (solver.load(checkpoint)) cout << "Resumed from " << checkpoint << " at " << solver.iterations << " iterations\n";
+    } catch (const runtime_error& e) {
+        cout << "Invalid checkpoint: " << e.what() << endl;
+        return;
+    }
+    auto start = chrono::steady_clock::now();
+    unsigned long long before = solver.iterations;
+    solver.train(iterations, thread::hardware_concurrency(), checkpoint);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    solver.exportPolicy(policyPath);
+    cout << "Trained to " << solver.iterations << " iterations (" << (solver.iterations - before) / max(seconds, 1e-9)
+         << "/s), policy written to " << policyPath << endl;
+}
+
+void runSimulation(long long games, vector<string> names, bool allDiscard) {
+    SimStats stats;
+    bool same = names[0] == names[1] && names[1] == names[2] && names[2] == names[3];
+    if (same && names[0] == "first") stats = simulateStatic<FirstPlayablePolicy>(games, 1, allDiscard);
+    else if (same && names[0] == "random") stats = simulateStatic<RandomPolicy>(games, 1, allDiscard);
+    else if (same && names[0] == "greedy") stats = simulateStatic<GreedyPolicy>(games, 1, allDiscard);
+    else {
+        for (int i = 0; i < 4; i++)
+            if (!makePolicy(names[i])) {
+                cout << "Unknown policy: " << names[i] << endl;
+                return;
+            }
+        stats = simulateParallel<BotPolicy>(games, 1, allDiscard, [&](int i) { return makePolicy(names[i], i + 1); });
+    }
+    cout << "Hand kernels: " << handKernels.name << endl;
+    cout << "Games: " << stats.games << " | avg turns: " << (double)stats.turns / stats.games
+         << " | " << stats.games / stats.seconds << " games/s\n";
+    for (int i = 0; i < 4; i++)
+        cout << "Seat " << i << " (" << names[i] << "): " << 100.0 * stats.wins[i] / stats.games << "% wins\n";
+}
+
+string checkEndgameSolver() {
+    EndgameSolver cached(7, ENDGAME_DRAWS), uncached(7, ENDGAME_DRAWS, 0);
+    int compared = 0;
+    for (int n = 1; n <= 400 && compared < 20; n++) {
+        GameState s;
+        if (!reachEndgame(s, cached, n)) continue;
+        cached.clear();
+        EndgameResult a = cached.solve(s), b = uncached.solve(s);
+        double total = 0;
+        for (int i = 0; i < 4; i++) {
+            total += a.winProb[i];
+            if (fabs(a.winProb[i] - b.winProb[i]) > 1e-9)
+                return "position " + to_string(n) + ": seat " + to_string(i) + " wins " + to_string(a.winProb[i]) + " with the table, "
+                    + to_string(b.winProb[i]) + " without";
+        }
+        if (fabs(total - 1) > 1e-9) return "position " + to_string(n) + ": win probabilities sum to " + to_string(total);
+        if (a.exact != b.exact) return "position " + to_string(n) + ": exactness depends on the table";
+        compared++;
+    }
+    return compared ? "" : "no endgame position was reached";
+}
+
+struct Standing {
+    string name;
+    double rating;
+    long long games;
+    long long wins;
+};
+
+const int SEATINGS[6][4] = {
+    {0, 1, 0, 1}, {1, 0, 1, 0}, {0, 0, 1, 1}, {1, 1, 0, 0}, {0, 1, 1, 0}, {1, 0, 0, 1}
+};
+
+class Tournament {
+public:
+    vector<Standing> standings;
+    long long gamesPerPairing;
+    bool allDiscard;
+
+    Tournament(vector<string> names, long long games, bool enableAllDiscard = false) {
+        for (string n : names) standings.push_back({ n, 1500, 0, 0 });
+        beat.assign(standings.size(), vector<long long>(standings.size(), 0));
+        gamesPerPairing = games;
+        allDiscard = enableAllDiscard;
+    }
+
+    void roundRobin() {
+        vector<pair<int, int>> pairings;
+        for (int a = 0; a < (int)standings.size(); a++)
+            for (int b = a + 1; b < (int)standings.size(); b++)
+                pairings.push_back({ a, b });
+        playPairings(pairings);
+        printStandings();
+    }
+
+    void swiss(int rounds) {
+        vector<vector<bool>> met(standings.size(), vector<bool>(standings.size(), false));
+        for (int r = 0; r < rounds; r++) {
+            vector<int> order(standings.size());
+            for (int i = 0; i < (int)order.size(); i++) order[i] = i;
+            sort(order.begin(), order.end(), [&](int a, int b) { return standings[a].rating > standings[b].rating; });
+            vector<bool> paired(standings.size(), false);
+            vector<pair<int, int>> pairings;
+            for (int i = 0; i < (int)order.size(); i++) {
+                if (paired[order[i]]) continue;
+                int partner = -1;
+                for (int j = i + 1; j < (int)order.size(); j++) {
+                    if (paired[order[j]]) continue;
+                    if (partner < 0) partner = order[j];
+                    if (!met[order[i]][order[j]]) {
+                        partner = order[j];
+                        break;
+                    }
+                }
+                if (partner < 0) continue;
+                paired[order[i]] = paired[partner] = true;
+                met[order[i]][partner] = met[partner][order[i]] = true;
+                pairings.push_back({ order[i], partner });
+            }
+            cout << "Swiss round " << r + 1 << "\n";
+            playPairings(pairings);
+            printStandings();
+        }
+    }
+
+    void printStandings() {
+        lock_guard<mutex> guard(lock);
+        vector<Standing> sorted = standings;
+        sort(sorted.begin(), sorted.end(), [](const Standing& a, const Standing& b) { return a.rating > b.rating; });
+        for (int i = 0; i < (int)sorted.size(); i++)
+            cout << i + 1 << ". " << sorted[i].name << " | Elo " << (int)sorted[i].rating << " | games "
+                 << sorted[i].games << " | wins " << 100.0 * sorted[i].wins / max(1LL, sorted[i].games) << "%\n";
+        cout << endl;
+    }
+
+private:
+    mutex lock;
+    vector<vector<long long>> beat;
+
+    void record(int a, int b, long long aWins, long long bWins, long long games) {
+        lock_guard<mutex> guard(lock);
+        standings[a].games += games;
+        standings[b].games += games;
+        standings[a].wins += aWins;
+        standings[b].wins += bWins;
+        beat[a][b] += aWins;
+        beat[b][a] += bWins;
+    }
+
+    void rate() {
+        int n = (int)standings.size();
+        vector<double> strength(n, 1), next(n);
+        for (int iter = 0; iter < 10000; iter++) {
+            double change = 0, logSum = 0;
+            for (int i = 0; i < n; i++) {
+                double won = 0, weight = 0;
+                for (int j = 0; j < n; j++) {
+                    if (j == i || beat[i][j] + beat[j][i] == 0) continue;
+                    won += beat[i][j] + 1;
+                    weight += (beat[i][j] + beat[j][i] + 2) / (strength[i] + strength[j]);
+                }
+                next[i] = weight > 0 ? won / weight : 1;
+                logSum += log(next[i]);
+            }
+            for (int i = 0; i < n; i++) {
+                next[i] /= exp(logSum / n);
+                change = max(change, fabs(log(next[i] / strength[i])));
+            }
+            strength.swap(next);
+            if (change < 1e-10) break;
+        }
+        for (int i = 0; i < n; i++) standings[i].rating = 1500 + 400 * log10(strength[i]);
+    }
+
+    void playPairings(const vector<pair<int, int>>& pairings) {
+        const long long chunk = 600;
+        long long chunksPerPairing = (gamesPerPairing + chunk - 1) / chunk;
+        long long totalTasks = chunksPerPairing * pairings.size();
+        atomic<long long> completed(0);
+
+        TaskGroup group;
+        group.parallelFor(0, totalTasks, 1, [&](long long task, long long) {
+            auto pr = pairings[task / chunksPerPairing];
+            long long first = (task % chunksPerPairing) * chunk;
+            long long last = min(first + chunk, gamesPerPairing);
+            uint64_t base = ((uint64_t)pr.first << 48) ^ ((uint64_t)pr.second << 32);
+            unique_ptr<BotPolicy> policies[2] = { makePolicy(standings[pr.first].name, base ^ first ^ 1),
+                                                  makePolicy(standings[pr.second].name, base ^ first ^ 2) };
+            long long wins[2] = { 0, 0 };
+            for (long long g = first; g < last; g++) {
+                const int* seating = SEATINGS[g % 6];
+                BotPolicy* seats[4];
+                for (int i = 0; i < 4; i++) seats[i] = policies[seating[i]].get();
+                uint64_t seed = base ^ (uint64_t)g;
+                GameState s = GameState::deal(seed, allDiscard);
+                FastRng rng(~seed);
+                int winner = playGame(s, seats, rng);
+                if (winner >= 0) wins[seating[winner]]++;
+            }
+            record(pr.first, pr.second, wins[0], wins[1], last - first);
+            completed++;
+        });
+
+        auto lastReport = chrono::steady_clock::now();
+        while (!group.done()) {
+            this_thread::sleep_for(chrono::milliseconds(50));
+            if (chrono::steady_clock::now() - lastReport > chrono::seconds(5)) {
+                lastReport = chrono::steady_clock::now();
+                cout << "Progress: " << completed << "/" << totalTasks << " chunks\n";
+            }
+        }
+        group.wait();
+        rate();
+    }
+};
+
+struct PairedResult {
+    long long seeds;
+    long long games;
+    double meanDiff;
+    double pairedStdErr;
+    double unpairedStdErr;
+    double aWinRate;
+    double bWinRate;
+};
+
+double pairedSample(BotPolicy* const policies[2], uint64_t seed, bool allDiscard, double* gameOutcomes = nullptr) {
+    int wins[2] = { 0, 0 };
+    for (int perm = 0; perm < 6; perm++) {
+        BotPolicy* seats[4];
+        for (int j = 0; j < 4; j++) seats[j] = policies[SEATINGS[perm][j]];
+        policies[0]->reset(seed + 1);
+        policies[1]->reset(seed + 1);
+        GameState s = GameState::deal(seed, allDiscard);
+        FastRng rng(~seed);
+        int winner = playGame(s, seats, rng);
+        double x = 0;
+        if (winner >= 0) {
+            wins[SEATINGS[perm][winner]]++;
+            x = SEATINGS[perm][winner] == 0 ? 1 : -1;
+        }
+        if (gameOutcomes) gameOutcomes[perm] = x;
+    }
+    return (wins[0] - wins[1]) / 6.0;
+}
+
+PairedResult evaluatePaired(string a, string b, long long seeds, bool allDiscard, uint64_t baseSeed = 1) {
+    struct Sums {
+        double d, d2, x, x2;
+        long long aWins, bWins, n;
+    };
+    typedef array<unique_ptr<BotPolicy>, 2> Pair;
+    ObjectPool<Pair> pool([&] { return unique_ptr<Pair>(new Pair{ makePolicy(a), makePolicy(b) }); });
+    mutex lock;
+    vector<Sums> partial;
+
+    TaskGroup group;
+    group.parallelFor(0, seeds, 64, [&](long long first, long long last) {
+        unique_ptr<Pair> owned = pool.acquire();
+        BotPolicy* const policies[2] = { (*owned)[0].get(), (*owned)[1].get() };
+        Sums sums = { 0, 0, 0, 0, 0, 0, 0 };
+        for (long long i = first; i < last; i++) {
+            double outcomes[6];
+            double d = pairedSample(policies, baseSeed + (uint64_t)i * 0x9E3779B97F4A7C15ULL, allDiscard, outcomes);
+            for (double x : outcomes) {
+                sums.x += x;
+                sums.x2 += x * x;
+                if (x > 0) sums.aWins++;
+                if (x < 0) sums.bWins++;
+            }
+            sums.d += d;
+            sums.d2 += d * d;
+            sums.n++;
+        }
+        pool.release(std::move(owned));
+        lock_guard<mutex> guard(lock);
+        partial.push_back(sums);
+    });
+    group.wait();
+    double sumD = 0, sumD2 = 0, sumX = 0, sumX2 = 0;
+    long long aWins = 0, bWins = 0, n = 0;
+    for (const Sums& p : partial) {
+        sumD += p.d;
+        sumD2 += p.d2;
+        sumX += p.x;
+        sumX2 += p.x2;
+        aWins += p.aWins;
+        bWins += p.bWins;
+        n += p.n;
+    }
+
+    PairedResult r;
+    r.seeds = n;
+    r.games = n * 6;
+    r.meanDiff = n ? sumD / n : 0;
+    double varD = n > 1 ? (sumD2 - n * r.meanDiff * r.meanDiff) / (n - 1) : 0;
+    r.pairedStdErr = n ? sqrt(max(0.0, varD) / n) : 0;
+    double meanX = r.games ? sumX / r.games : 0;
+    double varX = r.games > 1 ? (sumX2 - r.games * meanX * meanX) / (r.games - 1) : 0;
+    r.unpairedStdErr = r.games ? sqrt(max(0.0, varX) / r.games) : 0;
+    r.aWinRate = r.games ? (double)aWins / r.games : 0;
+    r.bWinRate = r.games ? (double)bWins / r.games : 0;
+    return r;
+}
+
+void runPairedComparison(string a, string b, long long seeds, bool allDiscard) {
+    PairedResult r = evaluatePaired(a, b, seeds, allDiscard);
+    cout << a << " vs " << b << " | " << r.seeds << " seeds x 6 seatings = " << r.games << " games\n";
+    cout << a << " wins " << 100 * r.aWinRate << "% | " << b << " wins " << 100 * r.bWinRate << "%\n";
+    cout << "Paired difference: " << 100 * r.meanDiff << "% +/- " << 196 * r.pairedStdErr << "% (95% CI)\n";
+    cout << "Independent-game CI would be +/- " << 196 * r.unpairedStdErr << "%";
+    if (r.pairedStdErr > 0)
+        cout << " (" << pow(r.unpairedStdErr / r.pairedStdErr, 2) << "x fewer games needed with pairing)";
+    cout << endl;
+}
+
+struct StopRule {
+    double halfWidth;
+    bool useSprt;
+    double p0;
+    double p1;
+    double alpha;
+    double beta;
+    long long minSamples;
+    long long maxSamples;
+};
+
+struct SequentialResult {
+    long long samples;
+    double mean;
+    double halfWidth;
+    string decision;
+};
+
+struct alignas(64) SampleSlot {
+    atomic<unsigned> version;
+    atomic<long long> n;
+    atomic<double> sum;
+    atomic<double> sum2;
+
+    void publish(long long count, double total, double total2) {
+        unsigned v = version.load(memory_order_relaxed);
+        version.store(v + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        n.store(count, memory_order_relaxed);
+        sum.store(total, memory_order_relaxed);
+        sum2.store(total2, memory_order_relaxed);
+        version.store(v + 2, memory_order_release);
+    }
+
+    void read(long long& count, double& total, double& total2) const {
+        while (true) {
+            unsigned v = version.load(memory_order_acquire);
+            count = n.load(memory_order_relaxed);
+            total = sum.load(memory_order_relaxed);
+            total2 = sum2.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (!(v & 1) && version.load(memory_order_relaxed) == v) return;
+        }
+    }
+};
+
+SequentialResult runSequential(int threads, StopRule rule, function<function<double(long long)>()> makeSampler) {
+    threads = threads > 0 ? threads : 1;
+    vector<SampleSlot> slots(threads);
+    for (auto& slot : slots) {
+        slot.version = 0;
+        slot.n = 0;
+        slot.sum = 0;
+        slot.sum2 = 0;
+    }
+    atomic<long long> nextIndex(0);
+    atomic<bool> stop(false);
+
+    auto worker = [&](int id) {
+        function<double(long long)> sample = makeSampler();
+        long long n = 0;
+        double sum = 0, sum2 = 0;
+        while (!stop.load(memory_order_relaxed)) {
+            long long i = nextIndex++;
+            if (i >= rule.maxSamples) break;
+            double x = sample(i);
+            n++;
+            sum += x;
+            sum2 += x * x;
+            if ((n & 63) == 0) slots[id].publish(n, sum, sum2);
+        }
+        slots[id].publish(n, sum, sum2);
+    };
+
+    auto collect = [&](long long& n, double& sum, double& sum2) {
+        n = 0;
+        sum = sum2 = 0;
+        for (auto& slot : slots) {
+            long long count;
+            double total, total2;
+            slot.read(count, total, total2);
+            n += count;
+            sum += total;
+            sum2 += total2;
+        }
+    };
+
+    double upper = log((1 - rule.beta) / rule.alpha);
+    double lower = log(rule.beta / (1 - rule.alpha));
+    string decision = "max samples reached";
+    auto check = [&](long long n, double sum, double sum2) {
+        if (n < rule.minSamples || n < 2) return false;
+        if (rule.useSprt) {
+            double llr = sum * log(rule.p1 / rule.p0) + (n - sum) * log((1 - rule.p1) / (1 - rule.p0));
+            if (llr >= upper) decision = "accept H1 (p = " + to_string(rule.p1) + ")";
+            else if (llr <= lower) decision = "accept H0 (p = " + to_string(rule.p0) + ")";
+            else return false;
+            return true;
+        }
+        double mean = sum / n;
+        double var = max(0.0, (sum2 - n * mean * mean) / (n - 1));
+        if (1.96 * sqrt(var / n) > rule.halfWidth) return false;
+        decision = "target precision reached";
+        return true;
+    };
+
+    TaskGroup group;
+    group.parallelFor(0, threads, 1, [&](long long first, long long last) {
+        for (long long id = first; id < last; id++) worker((int)id);
+    });
+    long long n;
+    double sum, sum2;
+    while (true) {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        collect(n, sum, sum2);
+        if (group.done() || nextIndex >= rule.maxSamples || check(n, sum, sum2)) break;
+    }
+    stop = true;
+    group.wait();
+    collect(n, sum, sum2);
+
+    SequentialResult r;
+    r.samples = n;
+    r.mean = n ? sum / n : 0;
+    r.halfWidth = n > 1 ? 1.96 * sqrt(max(0.0, (sum2 - n * r.mean * r.mean) / (n - 1)) / n) : 0;
+    r.decision = decision;
+    return r;
+}
+
+void runSequentialCampaign(string metric, string a, string b, StopRule rule) {
+    function<function<double(long long)>()> makeSampler;
+    if (metric == "paired" || metric == "variant") {
+        makeSampler = [=]() {
+            shared_ptr<BotPolicy> owned[2] = { makePolicy(a), makePolicy(b) };
+            return function<double(long long)>([=](long long i) {
+                BotPolicy* const policies[2] = { owned[0].get(), owned[1].get() };
+                uint64_t seed = 1 + (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+                if (metric == "paired") return pairedSample(policies, seed, false);
+                return pairedSample(policies, seed, true) - pairedSample(policies, seed, false);
+            });
+        };
+    } else if (metric == "winrate" || metric == "length") {
+        makeSampler = [=]() {
+            shared_ptr<BotPolicy> owned[2] = { makePolicy(a), makePolicy(b) };
+            return function<double(long long)>([=](long long i) {
+                int seat = i % 4;
+                BotPolicy* seats[4];
+                for (int j = 0; j < 4; j++) seats[j] = owned[j == seat ? 0 : 1].get();
+                GameState s = GameState::deal(1 + i, false);
+                FastRng rng(~(uint64_t)i);
+                int winner = playGame(s, seats, rng);
+                if (metric == "length") return (double)s.turns;
+                return winner == seat ? 1.0 : 0.0;
+            });
+        };
+    } else {
+        cout << "Unknown metric: " << metric << endl;
+        return;
+    }
+    auto start = chrono::steady_clock::now();
+    SequentialResult r = runSequential(sharedExecutor().workerCount(), rule, makeSampler);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << metric << " (" << a << " vs " << b << "): " << r.mean << " +/- " << r.halfWidth
+         << " after " << r.samples << " samples in " << seconds << " s | " << r.decision << endl;
+}
+
+class EvolutionTuner {
+public:
+    int populationSize;
+    int parents;
+    long long seedsPerCandidate;
+    string opponent;
+    int generation;
+    double sigma;
+    vector<double> mean;
+    vector<double> bestWeights;
+    double bestFitness;
+    vector<vector<double>> population;
+    vector<double> fitness;
+    uint64_t seed;
+
+    EvolutionTuner(int lambda, long long seeds, string opponentName, uint64_t rngSeed) : rng(rngSeed) {
+        seed = rngSeed;
+        populationSize = lambda;
+        parents = max(1, lambda / 4);
+        seedsPerCandidate = seeds;
+        opponent = opponentName;
+        generation = 0;
+        sigma = 5;
+        mean = defaultHeuristicWeights();
+        bestWeights = mean;
+        bestFitness = -1e18;
+    }
+
+    void run(int generations, string checkpointPath) {
+        for (int g = 0; g < generations; g++) {
+            population.assign(populationSize, mean);
+            for (int i = 1; i < populationSize; i++)
+                for (double& w : population[i]) w += sigma * gaussian();
+            fitness = evaluate(population, 1 + (uint64_t)generation * 0x9E3779B97F4A7C15ULL);
+
+            vector<int> order(populationSize);
+            for (int i = 0; i < populationSize; i++) order[i] = i;
+            sort(order.begin(), order.end(), [&](int a, int b) { return fitness[a] > fitness[b]; });
+            vector<double> next(mean.size(), 0);
+            for (int i = 0; i < parents; i++)
+                for (int w = 0; w < (int)next.size(); w++) next[w] += population[order[i]][w] / parents;
+            mean = next;
+            if (fitness[order[0]] > bestFitness) {
+                bestFitness = fitness[order[0]];
+                bestWeights = population[order[0]];
+            }
+            sigma *= fitness[order[0]] > fitness[0] ? 1.0 : 0.85;
+            generation++;
+            cout << "Generation " << generation << " | best edge vs " << opponent << ": " << 100 * fitness[order[0]]
+                 << "% | sigma " << sigma << endl;
+            save(checkpointPath);
+        }
+    }
+
+    bool load(string path) {
+        ifstream in(path);
+        if (!in) return false;
+        json j;
+        in >> j;
+        generation = j["generation"];
+        sigma = j["sigma"];
+        mean = heuristicWeightsFromJson(j["mean"]);
+        bestWeights = heuristicWeightsFromJson(j["best"]);
+        bestFitness = j["best_fitness"];
+        population.clear();
+        fitness.clear();
+        if (j.contains("population")) {
+            for (const json& member : j["population"]) population.push_back(heuristicWeightsFromJson(member));
+            fitness = j["fitness"].get<vector<double>>();
+            if (population.empty() || fitness.size() != population.size())
+                throw runtime_error(path + ": population and fitness do not match");
+            populationSize = (int)population.size();
+            parents = max(1, populationSize / 4);
+        }
+        if (j.contains("seed")) seed = j["seed"].get<uint64_t>();
+        if (j.contains("rng")) rng.state = j["rng"].get<uint64_t>();
+        return true;
+    }
+
+    void save(string path) {
+        json members = json::array();
+        for (const vector<double>& member : population) members.push_back(heuristicWeightsToJson(member));
+        json j = {
+            {"generation", generation},
+            {"sigma", sigma},
+            {"opponent", opponent},
+            {"mean", heuristicWeightsToJson(mean)},
+            {"best", heuristicWeightsToJson(bestWeights)},
+            {"best_fitness", bestFitness},
+            {"population_size", populationSize},
+            {"population", members},
+            {"fitness", fitness},
+            {"seed", seed},
+            {"rng", rng.state}
+        };
+        string temp = path + ".tmp";
+        {
+            ofstream out(temp);
+            out << j.dump(4);
+        }
+        rename(temp.c_str(), path.c_str());
+    }
+
+private:
+    FastRng rng;
+
+    double gaussian() {
+        double u = max(rng.uniform(), 1e-12), v = rng.uniform();
+        return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+    }
+
+    vector<double> evaluate(const vector<vector<double>>& population, uint64_t baseSeed) {
+        long long tasks = (long long)population.size() * seedsPerCandidate;
+        vector<double> totals(population.size(), 0);
+        ObjectPool<BotPolicy> baselines([&] { return makePolicy(opponent); });
+        mutex lock;
+        TaskGroup group;
+        group.parallelFor(0, tasks, 64, [&](long long first, long long last) {
+            unique_ptr<BotPolicy> baseline = baselines.acquire();
+            vector<double> local(population.size(), 0);
+            for (long long task = first; task < last; task++) {
+                int candidate = task / seedsPerCandidate;
+                long long seedIndex = task % seedsPerCandidate;
+                HeuristicPolicy policy(population[candidate]);
+                BotPolicy* const policies[2] = { &policy, baseline.get() };
+                local[candidate] += pairedSample(policies, baseSeed + (uint64_t)seedIndex * 0x632BE59BD9B4E019ULL, false);
+            }
+            baselines.release(std::move(baseline));
+            lock_guard<mutex> guard(lock);
+            for (int i = 0; i < (int)local.size(); i++) totals[i] += local[i];
+        });
+        group.wait();
+        for (double& t : totals) t /= seedsPerCandidate;
+        return totals;
+    }
+};
+
+void runEvolution(string checkpoint, int generations, int population, long long seeds, string opponent, uint64_t seed,
+                  string bestPath) {
+    EvolutionTuner tuner(population, seeds, opponent, seed);
+    try {
+        if (tuner.load(checkpoint))
+            cout << "Resumed from " << checkpoint << " at generation " << tuner.generation << " (seed " << tuner.seed << ")" << endl;
+    } catch (const exception& e) {
+        cout << "Invalid checkpoint: " << e.what() << endl;
+        return;
+    }
+    tuner.run(generations, checkpoint);
+    ofstream out(bestPath);
+    out << heuristicWeightsToJson(tuner.bestWeights).dump(4);
+    cout << "Best weights (" << 100 * tuner.bestFitness << "% edge) written to " << bestPath << endl;
+}
+
+#ifdef __linux__
+enum WireType : uint8_t {
+    WIRE_JOIN = 1, WIRE_ACTION = 2, WIRE_WATCH = 3,
+    WIRE_TURN = 16, WIRE_RESULT = 17, WIRE_SNAPSHOT = 18,
+    WIRE_PLAYED = 19, WIRE_COLOR = 20, WIRE_DREW = 21
+};
+
+const uint8_t JOIN_ALL_DISCARD = 1;
+const uint8_t JOIN_DRAW_THEN_PLAY = 2;
+const uint8_t NO_WINNER = 255;
+const uint8_t SPECTATOR_SEAT = 255;
+const uint32_t ANY_TABLE = 0xFFFFFFFF;
+
+struct WireJoin {
+    uint8_t type, size, flags;
+    uint8_t rating[2];
+};
+
+struct WireAction {
+    uint8_t type, size, action;
+};
+
+struct WireTurn {
+    uint8_t type, size, seat, topKind, color, direction, pendingPenalty, drawnKind;
+    uint8_t handSize[4];
+    uint8_t hand[NUM_KINDS];
+    uint8_t legal[8];
+};
+
+struct WireResult {
+    uint8_t type, size, winner, seat;
+    uint8_t turns[2];
+};
+
+struct WireWatch {
+    uint8_t type, size;
+    uint8_t table[4];
+};
+
+struct WireSnapshot {
+    uint8_t type, size, topKind, color, direction, pendingPenalty, currentPlayer;
+    uint8_t handSize[4];
+    uint8_t table[4];
+};
+
+struct WirePlayed {
+    uint8_t type, size, seat, kind, handSize;
+};
+
+struct WireColor {
+    uint8_t type, size, color;
+};
+
+struct WireDrew {
+    uint8_t type, size, seat, count, handSize, penalty;
+};
+
+struct SharedBuffer {
+    static const int CAPACITY = 240;
+    int refs;
+    int size;
+    uint8_t data[CAPACITY];
+};
+
+class BufferPool {
+public:
+    ~BufferPool() {
+        for (SharedBuffer* b : free) delete b;
+    }
+
+    SharedBuffer* acquire() {
+        SharedBuffer* b;
+        if (free.empty()) b = new SharedBuffer;
+        else {
+            b = free.back();
+            free.pop_back();
+        }
+        b->refs = 1;
+        b->size = 0;
+        return b;
+    }
+
+    void retain(SharedBuffer* b) {
+        b->refs++;
+    }
+
+    void release(SharedBuffer* b) {
+        if (--b->refs == 0) free.push_back(b);
+    }
+
+private:
+    vector<SharedBuffer*> free;
+};
+
+int openListener(const string& address) {
+    int fd;
+    if (address.rfind("tcp:", 0) == 0) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)atoi(address.c_str() + 4));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4096) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(address.c_str());
+    if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4096) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connectTo(const string& address) {
+    int fd;
+    int status;
+    if (address.rfind("tcp:", 0) == 0) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)atoi(address.c_str() + 4));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        status = connect(fd, (sockaddr*)&addr, sizeof(addr));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        status = connect(fd, (sockaddr*)&addr, sizeof(addr));
+    }
+    if (status != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+enum HandoffType : uint8_t {
+    HANDOFF_LISTENER = 1, HANDOFF_TABLE = 2, HANDOFF_WATCHERS = 3, HANDOFF_CONNECTIONS = 4, HANDOFF_DONE = 5, HANDOFF_ACK = 6,
+    HANDOFF_ABORT = 7
+};
+
+const int HANDOFF_MAX_FDS = 200;
+const int HANDOFF_WINDOW = 8;
+const size_t HANDOFF_MAX_BYTES = 1 << 16;
+const int HANDOFF_SEND_MILLIS = 100;
+
+volatile sig_atomic_t drainRequested = 0;
+
+void requestDrain(int) {
+    drainRequested = 1;
+}
+
+string handoffPath(const string& address) {
+    return (address.rfind("tcp:", 0) == 0 ? "uno-" + address.substr(4) : address) + ".handoff";
+}
+
+bool sendHandoff(int sock, const vector<uint8_t>& bytes, const int* fds, int count) {
+    iovec iov = { (void*)bytes.data(), bytes.size() };
+    msghdr header = {};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    vector<uint8_t> control(CMSG_SPACE(sizeof(int) * max(count, 1)));
+    if (count > 0) {
+        header.msg_control = control.data();
+        header.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        cmsghdr* cm = CMSG_FIRSTHDR(&header);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * count);
+    }
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(HANDOFF_SEND_MILLIS);
+    while (true) {
+        ssize_t sent = sendmsg(sock, &header, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent >= 0) return sent == (ssize_t)bytes.size();
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+        int left = (int)chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        pollfd writable = { sock, POLLOUT, 0 };
+        if (left <= 0 || poll(&writable, 1, left) == 0) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+    }
+}
+
+bool peerHungUp(int sock) {
+    pollfd p = { sock, POLLRDHUP, 0 };
+    return poll(&p, 1, 0) == 1 && (p.revents & (POLLHUP | POLLRDHUP));
+}
+
+ssize_t receiveHandoff(int sock, vector<uint8_t>& bytes, vector<int>& fds) {
+    if (bytes.size() < HANDOFF_MAX_BYTES * 32) bytes.resize(HANDOFF_MAX_BYTES * 32);
+    uint8_t control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    iovec iov = { bytes.data(), bytes.size() };
+    msghdr header = {};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    ssize_t got = recvmsg(sock, &header, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    fds.clear();
+    if (got <= 0) return got;
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&header); cm; cm = CMSG_NXTHDR(&header, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* data = (const int*)CMSG_DATA(cm);
+        fds.insert(fds.end(), data, data + count);
+    }
+    return got;
+}
+
+void raiseFileLimit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+uint64_t humanActions(const GameState& s) {
+    return legalActions(s) | 1ULL << ACTION_DRAW;
+}
+
+class TimerWheel {
+public:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 4;
+    static const uint64_t MAX_DELAY = (1ULL << (ROOT_BITS + (LEVELS - 1) * LEVEL_BITS)) - 1;
+
+    TimerWheel(uint64_t start = 0) {
+        current = start;
+        armed = 0;
+        for (auto& h : root) h = -1;
+        for (auto& level : wheels)
+            for (auto& h : level) h = -1;
+    }
+
+    void resize(int timers) {
+        if (timers > (int)nodes.size()) nodes.resize(timers, Node{ -1, -1, 0, -1 });
+    }
+
+    bool active(int id) const {
+        return id < (int)nodes.size() && nodes[id].slot >= 0;
+    }
+
+    int size() const {
+        return armed;
+    }
+
+    uint64_t now() const {
+        return current;
+    }
+
+    void arm(int id, uint64_t delay) {
+        cancel(id);
+        nodes[id].expires = current + min(max(delay, (uint64_t)1), MAX_DELAY);
+        insert(id);
+        armed++;
+    }
+
+    void cancel(int id) {
+        if (!active(id)) return;
+        unlink(id);
+        armed--;
+    }
+
+    template <class Fire>
+    void advance(uint64_t until, Fire&& fire) {
+        while (current < until) {
+            if (armed == 0) {
+                current = until;
+                return;
+            }
+            current++;
+            int slot = current & (ROOT_SLOTS - 1);
+            if (slot == 0) cascade(0);
+            int id;
+            while ((id = root[slot]) >= 0) {
+                unlink(id);
+                armed--;
+                fire(id);
+            }
+        }
+    }
+
+private:
+    static const int ROOT_SLOTS = 1 << ROOT_BITS;
+    static const int LEVEL_SLOTS = 1 << LEVEL_BITS;
+
+    struct Node {
+        int prev, next;
+        uint64_t expires;
+        int slot;
+    };
+
+    uint64_t current;
+    int armed;
+    int root[ROOT_SLOTS];
+    int wheels[LEVELS - 1][LEVEL_SLOTS];
+    vector<Node> nodes;
+
+    int* head(int slot) {
+        return slot < ROOT_SLOTS ? &root[slot] : &wheels[0][0] + (slot - ROOT_SLOTS);
+    }
+
+    void insert(int id) {
+        Node& n = nodes[id];
+        uint64_t delta = n.expires - current;
+        int slot;
+        if (delta < ROOT_SLOTS) slot = n.expires & (ROOT_SLOTS - 1);
+        else {
+            int level = 0;
+            while (level < LEVELS - 2 && delta >= 1ULL << (ROOT_BITS + (level + 1) * LEVEL_BITS)) level++;
+            slot = ROOT_SLOTS + level * LEVEL_SLOTS + (n.expires >> (ROOT_BITS + level * LEVEL_BITS) & (LEVEL_SLOTS - 1));
+        }
+        int* h = head(slot);
+        n.slot = slot;
+        n.prev = -1;
+        n.next = *h;
+        if (*h >= 0) nodes[*h].prev = id;
+        *h = id;
+    }
+
+    void unlink(int id) {
+        Node& n = nodes[id];
+        if (n.prev >= 0) nodes[n.prev].next = n.next;
+        else *head(n.slot) = n.next;
+        if (n.next >= 0) nodes[n.next].prev = n.prev;
+        n.slot = -1;
+    }
+
+    void cascade(int level) {
+        if (level >= LEVELS - 1) return;
+        int index = current >> (ROOT_BITS + level * LEVEL_BITS) & (LEVEL_SLOTS - 1);
+        if (index == 0) cascade(level + 1);
+        int id = wheels[level][index];
+        wheels[level][index] = -1;
+        while (id >= 0) {
+            int next = nodes[id].next;
+            insert(id);
+            id = next;
+        }
+    }
+};
+
+string checkTimerWheel() {
+    const int timers = 1000;
+    const int spans[4] = { 1 << 8, 1 << 14, 1 << 20, 1 << 22 };
+    FastRng rng(11);
+    TimerWheel wheel(12345);
+    wheel.resize(timers);
+    vector<uint64_t> due(timers, 0);
+    string error;
+    auto fire = [&](int id) {
+        if (due[id] != wheel.now() && error.empty())
+            error = "timer " + to_string(id) + " due at " + to_string(due[id]) + " fired at " + to_string(wheel.now());
+        due[id] = 0;
+    };
+    for (int round = 0; round < 20000 && error.empty(); round++) {
+        int id = rng.below(timers);
+        int op = rng.below(8);
+        if (op < 4) {
+            uint64_t delay = 1 + rng.below(spans[rng.below(4)]);
+            wheel.arm(id, delay);
+            due[id] = wheel.now() + delay;
+        } else if (op == 4) {
+            wheel.cancel(id);
+            due[id] = 0;
+        } else {
+            uint64_t step = rng.below(op == 7 && rng.below(10) == 0 ? 1 << 20 : 300);
+            wheel.advance(wheel.now() + step, fire);
+        }
+        int armed = 0;
+        for (int i = 0; i < timers; i++) {
+            armed += due[i] != 0;
+            if (wheel.active(i) != (due[i] != 0)) return "timer " + to_string(i) + " is " + (wheel.active(i) ? "armed" : "idle") + " unexpectedly";
+        }
+        if (wheel.size() != armed) return "wheel holds " + to_string(wheel.size()) + " timers, expected " + to_string(armed);
+    }
+    wheel.advance(wheel.now() + (1 << 22) + 1, fire);
+    if (!error.empty()) return error;
+    for (int i = 0; i < timers; i++)
+        if (due[i]) return "timer " + to_string(i) + " never fired";
+    return "";
+}
+
+struct MatchRequest {
+    int fd;
+    uint32_t generation;
+    uint16_t rating;
+    uint8_t flags;
+};
+
+struct MatchResult {
+    int fds[4];
+    uint32_t generations[4];
+    uint8_t flags;
+    uint8_t humans;
+};
+
+class Lobby {
+public:
+    static const int BRACKETS = 16;
+    static const int RULES = 4;
+
+    int wakeFd;
+    atomic<long long> matched;
+    atomic<long long> botFilled;
+    atomic<long long> seated;
+    atomic<long long> waitedMicros;
+    atomic<long long> maxWaitMicros;
+
+    Lobby(double fillSeconds = 2, int width = 200) : requests(1 << 16), matches(1 << 16) {
+        fillAfter = chrono::microseconds((long long)(fillSeconds * 1e6));
+        bracketWidth = width;
+        wakeFd = -1;
+        running = false;
+        matched = botFilled = seated = waitedMicros = maxWaitMicros = 0;
+    }
+
+    ~Lobby() {
+        stop();
+    }
+
+    bool start() {
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeFd < 0) return false;
+        running = true;
+        matcher = thread(&Lobby::run, this);
+        return true;
+    }
+
+    void stop() {
+        if (!running) return;
+        running = false;
+        matcher.join();
+        close(wakeFd);
+        wakeFd = -1;
+    }
+
+    bool submit(const MatchRequest& request) {
+        return requests.push(request);
+    }
+
+    bool next(MatchResult& result) {
+        return matches.pop(result);
+    }
+
+private:
+    struct Waiting {
+        MatchRequest request;
+        chrono::steady_clock::time_point since;
+    };
+
+    MpmcQueue<MatchRequest> requests;
+    MpmcQueue<MatchResult> matches;
+    chrono::steady_clock::duration fillAfter;
+    int bracketWidth;
+    atomic<bool> running;
+    thread matcher;
+    deque<Waiting> buckets[BRACKETS * RULES];
+    vector<MatchResult> backlog;
+
+    int bucketOf(const MatchRequest& r) const {
+        return min(r.rating / bracketWidth, BRACKETS - 1) * RULES + (r.flags & (RULES - 1));
+    }
+
+    void seat(deque<Waiting>& bucket, int humans, chrono::steady_clock::time_point now) {
+        MatchResult m;
+        m.flags = bucket.front().request.flags;
+        m.humans = humans;
+        for (int i = 0; i < 4; i++) {
+            m.fds[i] = -1;
+            m.generations[i] = 0;
+            if (i >= humans) continue;
+            const Waiting& w = bucket.front();
+            m.fds[i] = w.request.fd;
+            m.generations[i] = w.request.generation;
+            long long waited = chrono::duration_cast<chrono::microseconds>(now - w.since).count();
+            waitedMicros += waited;
+            if (waited > maxWaitMicros) maxWaitMicros = waited;
+            bucket.pop_front();
+        }
+        seated += humans;
+        matched++;
+        if (humans < 4) botFilled++;
+        backlog.push_back(m);
+    }
+
+    void run() {
+        auto lastScan = chrono::steady_clock::now();
+        while (running) {
+            auto now = chrono::steady_clock::now();
+            MatchRequest r;
+            int received = 0;
+            while (received < 4096 && requests.pop(r)) {
+                deque<Waiting>& bucket = buckets[bucketOf(r)];
+                bucket.push_back({ r, now });
+                if (bucket.size() == 4) seat(bucket, 4, now);
+                received++;
+            }
+            if (now - lastScan >= chrono::milliseconds(5)) {
+                lastScan = now;
+                for (auto& bucket : buckets)
+                    if (!bucket.empty() && now - bucket.front().since >= fillAfter) seat(bucket, (int)bucket.size(), now);
+            }
+            size_t pushed = 0;
+            while (pushed < backlog.size() && matches.push(backlog[pushed])) pushed++;
+            backlog.erase(backlog.begin(), backlog.begin() + pushed);
+            if (pushed) {
+                uint64_t one = 1;
+                ssize_t written = write(wakeFd, &one, 8);
+                (void)written;
+            }
+            if (!received) this_thread::sleep_for(chrono::microseconds(200));
+        }
+    }
+};
+
+struct ServerTable {
+    GameState state;
+    int clients[4];
+    unique_ptr<BotPolicy> bots[4];
+    vector<int> spectators;
+    SharedBuffer* events;
+    FastRng rng;
+    bool observed;
+    bool live;
+};
+
+struct OutSegment {
+    SharedBuffer* buffer;
+    int offset;
+};
+
+struct ServerConnection {
+    bool open;
+    bool broken;
+    int table;
+    int seat;
+    int watching;
+    uint32_t generation;
+    bool waiting;
+    bool polling;
+    bool queued;
+    uint16_t rating;
+    uint8_t joinFlags;
+    vector<uint8_t> in;
+    deque<OutSegment> out;
+};
+
+class GameServer {
+public:
+    string address;
+    string botName;
+    int listenFd;
+    int epollFd;
+    vector<ServerTable> tables;
+    vector<int> freeTables;
+    vector<ServerConnection> connections;
+    long long liveTables;
+    long long games;
+    long long moves;
+    long long timeouts;
+    long long broadcasts;
+    long long deliveries;
+    double handledMicros;
+    double maxHandledMicros;
+    uint64_t nextSeed;
+    TimerWheel timers;
+    chrono::steady_clock::time_point epoch;
+    int tickMillis;
+    uint64_t turnTicks;
+    uint64_t stackTicks;
+    BufferPool buffers;
+    vector<int> dirty;
+    size_t watchCursor;
+    Lobby lobby;
+    uint32_t generations;
+    int handoffFd;
+    bool draining;
+    bool handedOff;
+    size_t drainCursor;
+    int inFlight;
+    long long migratedTables;
+    long long migratedConnections;
+    double pauseMicros;
+    double maxPauseMicros;
+    chrono::steady_clock::time_point migrationStart;
+    vector<int> adoptedTables;
+    vector<uint8_t> handoffBuffer;
+
+    GameServer(string addr, string bot, double turnSeconds = 20, double stackSeconds = 8, double fillSeconds = 2) : lobby(fillSeconds) {
+        address = addr;
+        botName = bot;
+        listenFd = -1;
+        epollFd = -1;
+        liveTables = games = moves = timeouts = broadcasts = deliveries = 0;
+        watchCursor = 0;
+        generations = 0;
+        handoffFd = -1;
+        draining = handedOff = false;
+        drainCursor = 0;
+        inFlight = 0;
+        migratedTables = migratedConnections = 0;
+        pauseMicros = maxPauseMicros = 0;
+        handledMicros = maxHandledMicros = 0;
+        nextSeed = 1;
+        epoch = chrono::steady_clock::now();
+        tickMillis = 10;
+        turnTicks = (uint64_t)max(0.0, turnSeconds * 1000 / tickMillis);
+        stackTicks = (uint64_t)max(0.0, stackSeconds * 1000 / tickMillis);
+    }
+
+    ~GameServer() {
+        if (listenFd >= 0) close(listenFd);
+        if (epollFd >= 0) close(epollFd);
+        if (handoffFd >= 0) close(handoffFd);
+        for (int fd = 0; fd < (int)connections.size(); fd++) {
+            if (connections[fd].open) close(fd);
+            for (OutSegment& seg : connections[fd].out) buffers.release(seg.buffer);
+        }
+        for (ServerTable& t : tables)
+            if (t.events) buffers.release(t.events);
+        if (!handedOff && address.rfind("tcp:", 0) != 0) unlink(address.c_str());
+    }
+
+    bool start() {
+        raiseFileLimit();
+        listenFd = openListener(address);
+        if (listenFd < 0) return false;
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        watchFd(listenFd);
+        if (!lobby.start()) return false;
+        watchFd(lobby.wakeFd);
+        return true;
+    }
+
+    bool takeover() {
+        raiseFileLimit();
+        string path = handoffPath(address);
+        int server = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(path.c_str());
+        if (::bind(server, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 1) != 0) {
+            close(server);
+            return false;
+        }
+        cout << "Waiting for a draining server on " << path << endl;
+        handoffFd = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+        close(server);
+        unlink(path.c_str());
+        if (handoffFd < 0) return false;
+        migrationStart = chrono::steady_clock::now();
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        watchFd(handoffFd);
+        if (!lobby.start()) return false;
+        watchFd(lobby.wakeFd);
+        return true;
+    }
+
+    void run(double seconds) {
+        auto begin = chrono::steady_clock::now();
+        auto lastReport = begin;
+        long long reportedMoves = 0, reportedDeliveries = 0;
+        epoll_event events[512];
+        while (!handedOff && (seconds <= 0 || chrono::duration<double>(chrono::steady_clock::now() - begin).count() < seconds)) {
+            if (drainRequested && !draining) startDrain();
+            int n = epoll_wait(epollFd, events, 512, draining && inFlight < HANDOFF_WINDOW ? 0 : timers.size() ? tickMillis : 1000);
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptAll();
+                    continue;
+                }
+                if (fd == handoffFd) {
+                    if (draining) receiveAcks();
+                    else adopt();
+                    continue;
+                }
+                if (fd == lobby.wakeFd) {
+                    seatMatches();
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) flush(fd);
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) readFrom(fd);
+            }
+            flushDirty();
+            if (draining) drainSome();
+            auto now = chrono::steady_clock::now();
+            timers.advance(tick(now), [this](int table) { expire(table); });
+            double sinceReport = chrono::duration<double>(now - lastReport).count();
+            if (sinceReport >= 10) {
+                cout << "Tables " << liveTables << " | games " << games << " | timeouts " << timeouts << " | " << (moves - reportedMoves) / sinceReport
+                     << " moves/s | " << (deliveries - reportedDeliveries) / sinceReport << " deliveries/s | mean handling "
+                     << (moves ? handledMicros / moves : 0) << " us | max " << maxHandledMicros << " us\n";
+                cout << "Lobby: " << lobby.matched << " tables (" << lobby.botFilled << " bot-filled) | mean wait "
+                     << (lobby.seated ? lobby.waitedMicros / 1000.0 / lobby.seated : 0) << " ms | max " << lobby.maxWaitMicros / 1000.0 << " ms\n";
+                reportedMoves = moves;
+                reportedDeliveries = deliveries;
+                maxHandledMicros = 0;
+                lastReport = now;
+            }
+        }
+    }
+
+private:
+    uint64_t tick(chrono::steady_clock::time_point when) const {
+        return chrono::duration_cast<chrono::milliseconds>(when - epoch).count() / tickMillis;
     }
 
-    void generate() {
-        cards.clear();
-        for (int c = RED; c <= YELLOW; c++) {
-            for (int n = 0; n <= 9; n++)
-                cards.push_back(Card((Color)c, NUMBER, n));
-            for (int t = SKIP; t <= DRAW_TWO; t++)
-                cards.push_back(Card((Color)c, (Type)t));
-        }
-        for (int i = 0; i < 4; i++) {
-            cards.push_back(Card(NONE, WILD));
-            cards.push_back(Card(NONE, WILD_DRAW_FOUR));
-        }
+    void expire(int table) {
+        ServerTable& t = tables[table];
+        if (!t.live || t.clients[t.state.currentPlayer] < 0) return;
+        timeouts++;
+        play(t, ACTION_DRAW);
+        advance(table);
     }
 
-    void shuffle() {
-        srand(time(0));
-        for (int i = 0; i < cards.size(); i++) {
-            int j = rand() % cards.size();
-            swap(cards[i], cards[j]);
+    void acceptAll() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            attach(fd);
         }
     }
 
-    Card drawCard() {
-        if (cards.empty()) generate();
-        Card c = cards.back();
-        cards.pop_back();
+    void watchFd(int fd) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    ServerConnection& attach(int fd) {
+        if (fd >= (int)connections.size()) connections.resize(fd + 1);
+        ServerConnection& c = connections[fd];
+        c.open = true;
+        c.broken = false;
+        c.table = -1;
+        c.seat = -1;
+        c.watching = -1;
+        c.generation = ++generations;
+        c.waiting = false;
+        c.polling = false;
+        c.queued = false;
+        c.rating = 1500;
+        c.joinFlags = 0;
+        c.in.clear();
+        c.out.clear();
+        watchFd(fd);
         return c;
     }
 
-    void placeCard(Card c) {
-        pile.push(c);
+    void detach(int fd) {
+        ServerConnection& c = connections[fd];
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        c.open = false;
+        c.table = c.watching = -1;
+        c.waiting = false;
+        for (OutSegment& seg : c.out) buffers.release(seg.buffer);
+        c.out.clear();
+        c.in.clear();
     }
 
-    Card topCard() {
-        return pile.top();
+    void saveConnection(SnapshotWriter& w, int fd) {
+        ServerConnection& c = connections[fd];
+        w.u32(c.in.size());
+        w.bytes.insert(w.bytes.end(), c.in.begin(), c.in.end());
+        uint32_t pending = 0;
+        for (OutSegment& seg : c.out) pending += seg.buffer->size - seg.offset;
+        w.u32(pending);
+        for (OutSegment& seg : c.out) w.bytes.insert(w.bytes.end(), seg.buffer->data + seg.offset, seg.buffer->data + seg.buffer->size);
     }
-};
 
-class Player {
-public:
-    vector<Card> hand;
-    string name;
-    bool isBot;
+    ServerConnection& loadConnection(SnapshotReader& r, int fd) {
+        ServerConnection& c = attach(fd);
+        uint32_t size = r.u32();
+        if (size > (uint32_t)(r.end - r.pos)) r.ok = false;
+        if (!r.ok) return c;
+        c.in.assign(r.pos, r.pos + size);
+        r.pos += size;
+        size = r.u32();
+        if (size > (uint32_t)(r.end - r.pos)) r.ok = false;
+        for (uint32_t done = 0; r.ok && done < size; done += SharedBuffer::CAPACITY) {
+            SharedBuffer* b = buffers.acquire();
+            b->size = min<uint32_t>(SharedBuffer::CAPACITY, size - done);
+            memcpy(b->data, r.pos + done, b->size);
+            deliver(fd, b, false);
+            buffers.release(b);
+        }
+        if (r.ok) r.pos += size;
+        return c;
+    }
 
-    Player(string n, bool bot = false) {
-        name = n;
-        isBot = bot;
+    void startDrain() {
+        draining = true;
+        string path = handoffPath(address);
+        handoffFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        int buffer = 1 << 20;
+        setsockopt(handoffFd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+        vector<uint8_t> msg(1, HANDOFF_LISTENER);
+        if (connect(handoffFd, (sockaddr*)&addr, sizeof(addr)) != 0 || !sendHandoff(handoffFd, msg, &listenFd, 1)) {
+            cout << "No server is taking over on " << path << ", still serving\n";
+            close(handoffFd);
+            handoffFd = -1;
+            draining = false;
+            drainRequested = 0;
+            return;
+        }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, listenFd, nullptr);
+        watchFd(handoffFd);
+        migrationStart = chrono::steady_clock::now();
+        cout << "Draining " << liveTables << " tables to " << path << endl;
     }
 
-    void draw(Deck& deck, int count = 1) {
-        for (int i = 0; i < count; i++)
-            hand.push_back(deck.drawCard());
+    void abortDrain(const string& what) {
+        bool released = peerHungUp(handoffFd);
+        if (!released) {
+            vector<uint8_t> abort(1, HANDOFF_ABORT);
+            released = sendHandoff(handoffFd, abort, nullptr, 0);
+        }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, handoffFd, nullptr);
+        close(handoffFd);
+        handoffFd = -1;
+        draining = false;
+        drainRequested = 0;
+        drainCursor = 0;
+        inFlight = 0;
+        if (released) {
+            watchFd(listenFd);
+            cout << "Hand-off failed while " << what << ", still serving " << liveTables << " tables\n";
+        } else {
+            cout << "Hand-off failed while " << what << " and the new server did not take the abort; it keeps the listener, serving "
+                 << liveTables << " remaining tables without accepting\n";
+        }
     }
 
-    bool canPlay(Card c, Card top, Color currentColor) {
-        if (c.type == WILD || c.type == WILD_DRAW_FOUR) return true;
-        if (c.color == currentColor) return true;
-        if (c.type == top.type && c.type != NUMBER) return true;
-        if (c.type == NUMBER && top.type == NUMBER && c.number == top.number) return true;
-        return false;
+    void receiveAcks() {
+        vector<int> fds;
+        ssize_t got;
+        while ((got = receiveHandoff(handoffFd, handoffBuffer, fds)) > 0) {
+            SnapshotReader r(handoffBuffer.data(), got);
+            if (r.u8() == HANDOFF_ACK) inFlight = max(0, inFlight - (int)r.u32());
+            for (int fd : fds) close(fd);
+        }
+        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) abortDrain("waiting for acknowledgements");
     }
 
-    bool hasPlayableCard(Card top, Color currentColor) {
-        for (Card card : hand)
-            if (canPlay(card, top, currentColor)) return true;
-        return false;
+    void drainSome() {
+        for (; drainCursor < tables.size() && inFlight < HANDOFF_WINDOW; drainCursor++)
+            if (tables[drainCursor].live) {
+                if (!handOffTable((int)drainCursor)) {
+                    abortDrain("sending table " + to_string(drainCursor));
+                    return;
+                }
+                inFlight++;
+            }
+        if (drainCursor < tables.size() || inFlight > 0) return;
+        vector<int> rest;
+        for (int fd = 0; fd < (int)connections.size(); fd++)
+            if (connections[fd].open) rest.push_back(fd);
+        for (size_t i = 0; i < rest.size(); i += HANDOFF_MAX_FDS) {
+            int count = (int)min(rest.size() - i, (size_t)HANDOFF_MAX_FDS);
+            SnapshotWriter w;
+            w.u8(HANDOFF_CONNECTIONS);
+            w.u16(count);
+            for (int j = 0; j < count; j++) {
+                ServerConnection& c = connections[rest[i + j]];
+                w.u8(c.waiting);
+                w.u16(c.rating);
+                w.u8(c.joinFlags);
+                saveConnection(w, rest[i + j]);
+            }
+            if (!sendHandoff(handoffFd, w.bytes, &rest[i], count)) {
+                abortDrain("sending idle connections");
+                return;
+            }
+            for (int j = 0; j < count; j++) detach(rest[i + j]);
+            migratedConnections += count;
+        }
+        vector<uint8_t> done(1, HANDOFF_DONE);
+        if (!sendHandoff(handoffFd, done, nullptr, 0)) {
+            abortDrain("sending the final marker");
+            return;
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - migrationStart).count();
+        cout << "Drained " << migratedTables << " tables and " << migratedConnections << " idle connections in " << ms
+             << " ms | max hand-off " << maxPauseMicros << " us per table\n";
+        handedOff = true;
     }
 
-    Card chooseCard(Card top, Color& newColor, Color currentColor) {
-        while (true) {
-            cout << "\nYour hand:\n";
-            for (int i = 0; i < hand.size(); i++)
-                cout << i + 1 << ". " << hand[i].toString() << endl;
-            cout << "0. Draw a card\nChoose: ";
-            int choice;
-            cin >> choice;
-            if (choice == 0) return Card(NONE, NUMBER);
-            if (choice >= 1 && choice <= hand.size()) {
-                Card selected = hand[choice - 1];
-                if (canPlay(selected, top, currentColor)) {
-                    hand.erase(hand.begin() + (choice - 1));
-                    if (selected.type == WILD || selected.type == WILD_DRAW_FOUR) {
-                        int col;
-                        cout << "Choose color (0=Red, 1=Green, 2=Blue, 3=Yellow): ";
-                        cin >> col;
-                        newColor = (Color)col;
-                    } else {
-                        newColor = selected.color;
-                    }
-                    return selected;
-                } else {
-                    cout << "Invalid card. Try again.\n";
+    bool handOffTable(int table) {
+        auto start = chrono::steady_clock::now();
+        ServerTable& t = tables[table];
+        SnapshotWriter w;
+        int fds[4], count = 0;
+        w.u8(HANDOFF_TABLE);
+        w.u32(table);
+        w.u64(chrono::duration_cast<chrono::nanoseconds>(start.time_since_epoch()).count());
+        t.state.save(w);
+        w.u64(t.rng.state);
+        int humans = 0;
+        for (int i = 0; i < 4; i++)
+            if (t.clients[i] >= 0) humans |= 1 << i;
+        w.u8(humans);
+        for (int i = 0; i < 4; i++)
+            if (t.clients[i] >= 0) {
+                saveConnection(w, t.clients[i]);
+                fds[count++] = t.clients[i];
+            }
+        if (!sendHandoff(handoffFd, w.bytes, fds, count)) return false;
+        for (int i = 0; i < count; i++) detach(fds[i]);
+        bool sent = true;
+        for (size_t i = 0; i < t.spectators.size(); ) {
+            SnapshotWriter sw;
+            sw.u8(HANDOFF_WATCHERS);
+            sw.u32(table);
+            size_t countAt = sw.bytes.size();
+            sw.u16(0);
+            int n = 0;
+            while (i + n < t.spectators.size() && n < HANDOFF_MAX_FDS && sw.bytes.size() < HANDOFF_MAX_BYTES) saveConnection(sw, t.spectators[i + n++]);
+            sw.bytes[countAt] = n & 255;
+            sw.bytes[countAt + 1] = n >> 8;
+            if (!sendHandoff(handoffFd, sw.bytes, &t.spectators[i], n)) {
+                WireResult none = { WIRE_RESULT, sizeof(WireResult), NO_WINNER, SPECTATOR_SEAT, { 0, 0 } };
+                for (; i < t.spectators.size(); i++) {
+                    connections[t.spectators[i]].watching = -1;
+                    send(t.spectators[i], &none, sizeof(none));
                 }
+                sent = false;
+                break;
             }
+            for (int j = 0; j < n; j++) detach(t.spectators[i + j]);
+            i += n;
+        }
+        for (int i = 0; i < 4; i++) {
+            t.clients[i] = -1;
+            t.bots[i].reset();
         }
+        t.spectators.clear();
+        timers.cancel(table);
+        t.live = false;
+        freeTables.push_back(table);
+        liveTables--;
+        migratedTables++;
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        maxPauseMicros = max(maxPauseMicros, micros);
+        return sent;
     }
 
-    Card playCard(Card top, Color currentColor, Color& newColor) {
-        if (!isBot) return chooseCard(top, newColor, currentColor);
-        for (int i = 0; i < hand.size(); i++) {
-            if (canPlay(hand[i], top, currentColor)) {
-                Card played = hand[i];
-                hand.erase(hand.begin() + i);
-                newColor = (played.type == WILD || played.type == WILD_DRAW_FOUR) ? (Color)(rand() % 4) : played.color;
-                return played;
+    void adopt() {
+        vector<int> fds;
+        uint32_t adopted = 0;
+        while (handoffFd >= 0) {
+            ssize_t got = receiveHandoff(handoffFd, handoffBuffer, fds);
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                if (adopted) {
+                    SnapshotWriter ack;
+                    ack.u8(HANDOFF_ACK);
+                    ack.u32(adopted);
+                    sendHandoff(handoffFd, ack.bytes, nullptr, 0);
+                }
+                return;
+            }
+            if (got <= 0) {
+                cout << "Draining server went away after " << migratedTables << " tables\n";
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, handoffFd, nullptr);
+                close(handoffFd);
+                handoffFd = -1;
+                return;
+            }
+            SnapshotReader r(handoffBuffer.data(), got);
+            int type = r.u8();
+            size_t used = 0;
+            if (type == HANDOFF_LISTENER && fds.size() == 1) {
+                listenFd = fds[0];
+                watchFd(listenFd);
+                used = 1;
+            } else if (type == HANDOFF_TABLE) {
+                used = adoptTable(r, fds);
+                adopted++;
+            } else if (type == HANDOFF_WATCHERS) {
+                uint32_t old = r.u32();
+                int n = r.u16();
+                int table = old < adoptedTables.size() ? adoptedTables[old] : -1;
+                for (; used < (size_t)n && used < fds.size() && r.ok; used++) {
+                    ServerConnection& c = loadConnection(r, fds[used]);
+                    if (table >= 0 && tables[table].live) {
+                        c.watching = table;
+                        tables[table].spectators.push_back(fds[used]);
+                    }
+                }
+            } else if (type == HANDOFF_CONNECTIONS) {
+                int n = r.u16();
+                for (; used < (size_t)n && used < fds.size() && r.ok; used++) {
+                    bool waiting = r.u8();
+                    uint16_t rating = r.u16();
+                    uint8_t flags = r.u8();
+                    ServerConnection& c = loadConnection(r, fds[used]);
+                    c.rating = rating;
+                    c.joinFlags = flags;
+                    if (waiting) join(fds[used]);
+                }
+                migratedConnections += used;
+            } else if (type == HANDOFF_ABORT) {
+                cout << "Draining server aborted the hand-off after " << migratedTables << " tables, serving them without accepting\n";
+                if (listenFd >= 0) {
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, listenFd, nullptr);
+                    close(listenFd);
+                    listenFd = -1;
+                }
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, handoffFd, nullptr);
+                close(handoffFd);
+                handoffFd = -1;
+                adoptedTables.clear();
+            } else if (type == HANDOFF_DONE) {
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - migrationStart).count();
+                cout << "Adopted " << migratedTables << " tables and " << migratedConnections << " idle connections in " << ms
+                     << " ms | pause mean " << (migratedTables ? pauseMicros / migratedTables : 0) << " us, max " << maxPauseMicros << " us\n";
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, handoffFd, nullptr);
+                close(handoffFd);
+                handoffFd = -1;
+                adoptedTables.clear();
             }
+            for (size_t i = used; i < fds.size(); i++) close(fds[i]);
         }
-        return Card(NONE, NUMBER);
     }
-};
 
-class Game {
-public:
-    Deck deck;
-    vector<Player> players;
-    int currentPlayer;
-    int direction;
-    Color currentColor;
-    bool allDiscardRule;
-    string playerName;
-    json& playerData;
+    size_t adoptTable(SnapshotReader& r, const vector<int>& fds) {
+        uint32_t old = r.u32();
+        int64_t stamp = (int64_t)r.u64();
+        int id = allocateTable();
+        ServerTable& t = tables[id];
+        bool ok = t.state.load(r);
+        t.rng = FastRng(r.u64());
+        int humans = r.u8();
+        size_t used = 0;
+        t.observed = false;
+        t.events = nullptr;
+        t.spectators.clear();
+        for (int i = 0; i < 4; i++) {
+            t.clients[i] = -1;
+            t.bots[i] = nullptr;
+            if (humans >> i & 1 && used < fds.size()) {
+                ServerConnection& c = loadConnection(r, fds[used]);
+                c.table = id;
+                c.seat = i;
+                t.clients[i] = fds[used++];
+            }
+            if (t.clients[i] < 0) {
+                t.bots[i] = makePolicy(botName, nextSeed++);
+                t.observed = t.observed || t.bots[i]->observes();
+            }
+        }
+        t.live = true;
+        liveTables++;
+        if (old >= adoptedTables.size()) adoptedTables.resize(old + 1, -1);
+        adoptedTables[old] = id;
+        if (!ok || !r.ok) {
+            for (int i = 0; i < 4; i++)
+                if (t.clients[i] >= 0) detach(t.clients[i]);
+            finish(id);
+            return used;
+        }
+        if (t.clients[t.state.currentPlayer] >= 0) armTurnTimer(id);
+        else advance(id);
+        double micros = (chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count() - stamp) / 1000.0;
+        pauseMicros += micros;
+        maxPauseMicros = max(maxPauseMicros, micros);
+        migratedTables++;
+        return used;
+    }
 
-    Game(string name, json& pdata, bool enableAllDiscard) : playerData(pdata) {
-        playerName = name;
-        allDiscardRule = enableAllDiscard;
+    void readFrom(int fd) {
+        ServerConnection& c = connections[fd];
+        uint8_t buffer[16384];
+        while (true) {
+            ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+            if (got > 0) {
+                c.in.insert(c.in.end(), buffer, buffer + got);
+                continue;
+            }
+            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) c.broken = true;
+            break;
+        }
+        size_t pos = 0;
+        while (!c.broken && c.in.size() - pos >= 2) {
+            uint8_t size = c.in[pos + 1];
+            if (size < 2) {
+                c.broken = true;
+                break;
+            }
+            if (c.in.size() - pos < size) break;
+            handle(fd, &c.in[pos], size);
+            pos += size;
+        }
+        c.in.erase(c.in.begin(), c.in.begin() + pos);
+        if (c.broken) closeConnection(fd);
+    }
 
-        players.push_back(Player(name));
-        players.push_back(Player("Bot1", true));
-        players.push_back(Player("Bot2", true));
-        players.push_back(Player("Bot3", true));
+    void send(int fd, const void* data, size_t size) {
+        SharedBuffer* b = buffers.acquire();
+        memcpy(b->data, data, size);
+        b->size = (int)size;
+        deliver(fd, b, true);
+        buffers.release(b);
+    }
 
-        for (auto& p : players)
-            p.draw(deck, 7);
+    void deliver(int fd, SharedBuffer* b, bool immediate) {
+        ServerConnection& c = connections[fd];
+        if (!c.open || c.broken) return;
+        deliveries++;
+        int offset = 0;
+        if (immediate && c.out.empty()) {
+            ssize_t sent = ::send(fd, b->data, b->size, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent == b->size) return;
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    c.broken = true;
+                    return;
+                }
+                sent = 0;
+            }
+            offset = (int)sent;
+        }
+        buffers.retain(b);
+        c.out.push_back({ b, offset });
+        if (!c.polling && !c.queued) {
+            c.queued = true;
+            dirty.push_back(fd);
+        }
+    }
 
-        Card first = deck.drawCard();
-        while (first.type == WILD_DRAW_FOUR) first = deck.drawCard();
-        currentColor = (first.type == WILD) ? (Color)(rand() % 4) : first.color;
-        deck.placeCard(first);
+    void flushDirty() {
+        for (size_t i = 0; i < dirty.size(); i++) {
+            connections[dirty[i]].queued = false;
+            flush(dirty[i]);
+        }
+        dirty.clear();
+    }
 
-        currentPlayer = 0;
-        direction = 1;
+    void poll(int fd, bool writable) {
+        ServerConnection& c = connections[fd];
+        if (c.polling == writable) return;
+        c.polling = writable;
+        epoll_event ev = {};
+        ev.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+    }
 
-        playerData["played_games"] = int(playerData["played_games"]) + 1;
+    void flush(int fd) {
+        ServerConnection& c = connections[fd];
+        if (!c.open) return;
+        iovec iov[64];
+        while (!c.out.empty()) {
+            int count = 0;
+            for (auto it = c.out.begin(); it != c.out.end() && count < 64; ++it, ++count) {
+                iov[count].iov_base = it->buffer->data + it->offset;
+                iov[count].iov_len = it->buffer->size - it->offset;
+            }
+            msghdr header = {};
+            header.msg_iov = iov;
+            header.msg_iovlen = count;
+            ssize_t sent = sendmsg(fd, &header, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent <= 0) {
+                if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) c.broken = true;
+                else poll(fd, true);
+                return;
+            }
+            while (sent > 0) {
+                OutSegment& seg = c.out.front();
+                int left = seg.buffer->size - seg.offset;
+                if (sent < left) {
+                    seg.offset += (int)sent;
+                    break;
+                }
+                sent -= left;
+                buffers.release(seg.buffer);
+                c.out.pop_front();
+            }
+        }
+        poll(fd, false);
+    }
 
-        mainLoop();
+    void emit(ServerTable& t, const void* msg, size_t size) {
+        if (t.events && t.events->size + size > SharedBuffer::CAPACITY) publish(t);
+        if (!t.events) t.events = buffers.acquire();
+        memcpy(t.events->data + t.events->size, msg, size);
+        t.events->size += (int)size;
     }
 
-    void endGame(bool won) {
-        if (won) playerData["wins"] = int(playerData["wins"]) + 1;
-        else playerData["losses"] = int(playerData["losses"]) + 1;
-        playerData["history"].push_back({ {"date", getTodayDate()}, {"result", won ? "win" : "loss"} });
+    void publish(ServerTable& t) {
+        SharedBuffer* b = t.events;
+        if (!b) return;
+        t.events = nullptr;
+        broadcasts++;
+        for (int i = 0; i < 4; i++)
+            if (t.clients[i] >= 0) deliver(t.clients[i], b, true);
+        for (int fd : t.spectators) deliver(fd, b, false);
+        buffers.release(b);
     }
 
-    void showCardCounts() {
-        cout << "\nCard counts: ";
-        for (auto& p : players) {
-            cout << p.name << ": " << p.hand.size();
-            if (p.hand.size() == 1) cout << " (UNO!)";
-            cout << " | ";
+    void watch(int fd, uint32_t table) {
+        ServerConnection& c = connections[fd];
+        if (table == ANY_TABLE)
+            for (size_t i = 0; i < tables.size() && table == ANY_TABLE; i++) {
+                watchCursor = (watchCursor + 1) % tables.size();
+                if (tables[watchCursor].live) table = (uint32_t)watchCursor;
+            }
+        if (table >= tables.size() || !tables[table].live) {
+            WireResult none = { WIRE_RESULT, sizeof(WireResult), NO_WINNER, SPECTATOR_SEAT, { 0, 0 } };
+            send(fd, &none, sizeof(none));
+            return;
         }
-        cout << endl;
+        ServerTable& t = tables[table];
+        const GameState& s = t.state;
+        t.spectators.push_back(fd);
+        c.watching = (int)table;
+        WireSnapshot msg;
+        msg.type = WIRE_SNAPSHOT;
+        msg.size = sizeof(WireSnapshot);
+        msg.topKind = s.topKind;
+        msg.color = s.currentColor;
+        msg.direction = s.direction > 0;
+        msg.pendingPenalty = min(s.pendingPenalty, 255);
+        msg.currentPlayer = s.currentPlayer;
+        for (int i = 0; i < 4; i++) msg.handSize[i] = min(s.handSize[i], 255);
+        memcpy(msg.table, &table, 4);
+        send(fd, &msg, sizeof(msg));
     }
 
-    void handleStacking(Type PType, int amount) {
-        int totalP = amount;
-        int next = (currentPlayer + direction + 4) % 4;
+    void unwatch(int fd) {
+        ServerConnection& c = connections[fd];
+        if (c.watching < 0) return;
+        vector<int>& list = tables[c.watching].spectators;
+        auto it = find(list.begin(), list.end(), fd);
+        if (it != list.end()) {
+            *it = list.back();
+            list.pop_back();
+        }
+        c.watching = -1;
+    }
 
-        while (true) {
-            Player& p = players[next];
-            bool hasSame = false;
-            for (Card c : p.hand)
-                if (c.type == PType && (PType == WILD_DRAW_FOUR || c.color == deck.topCard().color)) {
-                    hasSame = true;
-                    break;
-                }
+    void closeConnection(int fd) {
+        ServerConnection& c = connections[fd];
+        if (!c.open) return;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        c.open = false;
+        for (OutSegment& seg : c.out) buffers.release(seg.buffer);
+        c.out.clear();
+        unwatch(fd);
+        if (c.table >= 0) {
+            ServerTable& t = tables[c.table];
+            t.clients[c.seat] = -1;
+            t.bots[c.seat] = makePolicy(botName, nextSeed++);
+            t.observed = t.observed || t.bots[c.seat]->observes();
+            int table = c.table;
+            c.table = -1;
+            advance(table);
+        }
+    }
 
-            if (hasSame) {
-                if (p.isBot) {
-                    for (int i = 0; i < p.hand.size(); i++) {
-                        if (p.hand[i].type == PType) {
-                            Card played = p.hand[i];
-                            p.hand.erase(p.hand.begin() + i);
-                            deck.placeCard(played);
-                            cout << p.name << " plays " << played.toString() << " (stack)\n";
-                            totalP += (PType == DRAW_TWO) ? 2 : 4;
-                            currentColor = played.color == NONE ? (Color)(rand() % 4) : played.color;
-                            next = (next + direction + 4) % 4;
-                            break;
-                        }
-                    }
-                } else {
-                    cout << "You are penalized with " << totalP << " cards. You have a matching card.\n";
-                    cout << "Do you want to stack it? (1 = Yes, 0 = No): ";
-                    int choice;
-                    cin >> choice;
-                    if (choice == 1) {
-                        for (int i = 0; i < p.hand.size(); i++) {
-                            if (p.hand[i].type == PType) {
-                                Card played = p.hand[i];
-                                p.hand.erase(p.hand.begin() + i);
-                                deck.placeCard(played);
-                                cout << p.name << " plays " << played.toString() << " (stack)\n";
-                                totalP += (PType == DRAW_TWO) ? 2 : 4;
-                                if (PType == WILD_DRAW_FOUR) {
-                                    int col;
-                                    cout << "Choose color (0=Red, 1=Green, 2=Blue, 3=Yellow): ";
-                                    cin >> col;
-                                    currentColor = (Color)col;
-                                } else {
-                                    currentColor = played.color;
-                                }
-                                next = (next + direction + 4) % 4;
-                                break;
-                            }
-                        }
-                    } else {
-                        break;
-                    }
-                }
-            } else {
-                cout << p.name << " must draw " << totalP << " cards.\n";
-                p.draw(deck, totalP);
-                advanceTurn();
-                break;
+    void handle(int fd, const uint8_t* msg, uint8_t size) {
+        ServerConnection& c = connections[fd];
+        auto start = chrono::steady_clock::now();
+        if (msg[0] == WIRE_WATCH && size >= sizeof(WireWatch) && c.table < 0 && c.watching < 0) {
+            uint32_t table;
+            memcpy(&table, ((const WireWatch*)msg)->table, 4);
+            watch(fd, table);
+            return;
+        }
+        if (msg[0] == WIRE_JOIN && size >= offsetof(WireJoin, rating) && c.table < 0 && c.watching < 0 && !c.waiting) {
+            const WireJoin* request = (const WireJoin*)msg;
+            c.rating = 1500;
+            if (size >= sizeof(WireJoin)) memcpy(&c.rating, request->rating, 2);
+            c.joinFlags = request->flags;
+            join(fd);
+        } else if (msg[0] == WIRE_ACTION && size >= sizeof(WireAction) && c.table >= 0) {
+            int table = c.table;
+            ServerTable& t = tables[table];
+            int action = ((const WireAction*)msg)->action;
+            if (t.state.currentPlayer != c.seat || action >= NUM_ACTIONS || !(humanActions(t.state) >> action & 1)) {
+                sendTurn(table);
+                return;
             }
+            play(t, action);
+            advance(table);
+        } else {
+            return;
         }
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        handledMicros += micros;
+        maxHandledMicros = max(maxHandledMicros, micros);
+        moves++;
     }
 
-    void mainLoop() {
-        while (true) {
-            Player& p = players[currentPlayer];
-            Card top = deck.topCard();
-            showCardCounts();
-            cout << "\nTop card: " << top.toString() << " | Current color: " << colorToString(currentColor) << endl;
+    void join(int fd) {
+        ServerConnection& c = connections[fd];
+        c.waiting = true;
+        if (draining) return;
+        if (!lobby.submit({ fd, c.generation, c.rating, c.joinFlags })) {
+            int fds[4] = { fd, -1, -1, -1 };
+            seat(fds, c.joinFlags);
+        }
+    }
 
-            if (p.isBot && !p.hasPlayableCard(top, currentColor)) {
-                cout << p.name << " draws a card.\n";
-                p.draw(deck);
-                advanceTurn();
-                continue;
+    void seatMatches() {
+        uint64_t count;
+        ssize_t got = read(lobby.wakeFd, &count, 8);
+        (void)got;
+        MatchResult m;
+        while (lobby.next(m)) {
+            if (draining) continue;
+            for (int i = 0; i < m.humans; i++) {
+                ServerConnection& c = connections[m.fds[i]];
+                if (!c.open || c.broken || c.generation != m.generations[i] || !c.waiting) m.fds[i] = -1;
             }
+            seat(m.fds, m.flags);
+        }
+    }
 
-            Color newColor = currentColor;
-            Card played = p.playCard(top, currentColor, newColor);
+    void seat(int* fds, uint8_t flags) {
+        bool humans = false;
+        for (int i = 0; i < 4; i++) humans = humans || fds[i] >= 0;
+        if (!humans) return;
+        int table = openTable(fds, flags);
+        for (int i = 0; i < 4; i++) {
+            if (fds[i] < 0) continue;
+            ServerConnection& c = connections[fds[i]];
+            c.waiting = false;
+            c.table = table;
+            c.seat = i;
+        }
+        advance(table);
+    }
 
-            if (played.color == NONE && played.type == NUMBER && played.number == -1) {
-                cout << p.name << " drew a card.\n";
-                p.draw(deck);
-                advanceTurn();
-                continue;
-            }
+    int allocateTable() {
+        int id;
+        if (freeTables.empty()) {
+            id = (int)tables.size();
+            tables.emplace_back();
+            timers.resize(id + 1);
+        } else {
+            id = freeTables.back();
+            freeTables.pop_back();
+        }
+        return id;
+    }
 
-            cout << p.name << " plays " << played.toString() << endl;
-            deck.placeCard(played);
-            currentColor = newColor;
-
-            if (allDiscardRule) {
-                vector<Card>& hand = p.hand;
-                vector<Card> extras;
-                for (Card c : hand)
-                    if (c.color == played.color) extras.push_back(c);
-                for (Card c : extras) {
-                    cout << "-> " << p.name << " also discards " << c.toString() << " (All Discard)\n";
-                    auto it = find_if(hand.begin(), hand.end(), [&](Card a) { return a.equals(c); });
-                    if (it != hand.end()) hand.erase(it);
-                    deck.placeCard(c);
-                }
-            }
+    int openTable(const int* fds, uint8_t flags) {
+        int id = allocateTable();
+        ServerTable& t = tables[id];
+        uint64_t seed = nextSeed++;
+        t.state = GameState::deal(seed, flags & JOIN_ALL_DISCARD, flags & JOIN_DRAW_THEN_PLAY);
+        t.rng = FastRng(seed ^ 0x5DEECE66DULL);
+        t.observed = false;
+        t.events = nullptr;
+        t.spectators.clear();
+        for (int i = 0; i < 4; i++) {
+            t.clients[i] = fds[i];
+            t.bots[i] = fds[i] >= 0 ? nullptr : makePolicy(botName, seed * 4 + i);
+            t.observed = t.observed || (t.bots[i] && t.bots[i]->observes());
+        }
+        t.live = true;
+        liveTables++;
+        return id;
+    }
 
-            if (p.hand.empty()) {
-                cout << p.name << " wins the game!\n";
-                endGame(p.name == playerName);
-                break;
+    void play(ServerTable& t, int action) {
+        timers.cancel(&t - tables.data());
+        GameState before;
+        if (t.observed) before = t.state;
+        int seat = t.state.currentPlayer;
+        int sizes[4] = { t.state.handSize[0], t.state.handSize[1], t.state.handSize[2], t.state.handSize[3] };
+        int penalty = t.state.pendingPenalty;
+        int kind;
+        if (action < 0) {
+            kind = playTurn(t.state, t.bots[seat].get(), t.rng);
+        } else {
+            kind = action == ACTION_DRAW ? DRAW_MOVE : actionToKind(action);
+            applyAction(t.state, action, t.rng);
+        }
+        if (t.observed)
+            for (int i = 0; i < 4; i++)
+                if (t.bots[i] && t.bots[i]->observes()) t.bots[i]->observe(before, t.state, seat, kind);
+        emitDelta(t, seat, kind, sizes, penalty);
+    }
+
+    void emitDelta(ServerTable& t, int seat, int kind, const int* sizes, int penalty) {
+        const GameState& s = t.state;
+        if (kind != DRAW_MOVE) {
+            WirePlayed played = { WIRE_PLAYED, sizeof(WirePlayed), (uint8_t)seat, (uint8_t)kind, (uint8_t)min(s.handSize[seat], 255) };
+            emit(t, &played, sizeof(played));
+            if (s.currentColor != kindTable.color[kind]) {
+                WireColor color = { WIRE_COLOR, sizeof(WireColor), (uint8_t)s.currentColor };
+                emit(t, &color, sizeof(color));
             }
+        }
+        for (int i = 0; i < 4; i++) {
+            if (s.handSize[i] <= sizes[i]) continue;
+            bool forced = i != seat || (penalty > 0 && s.pendingPenalty == 0);
+            WireDrew drew = { WIRE_DREW, sizeof(WireDrew), (uint8_t)i, (uint8_t)min(s.handSize[i] - sizes[i], 255), (uint8_t)min(s.handSize[i], 255), (uint8_t)forced };
+            emit(t, &drew, sizeof(drew));
+        }
+    }
 
-            if (played.type == REVERSE) direction *= -1;
-            else if (played.type == SKIP) advanceTurn();
-            else if (played.type == DRAW_TWO) handleStacking(DRAW_TWO, 2);
-            else if (played.type == WILD_DRAW_FOUR) handleStacking(WILD_DRAW_FOUR, 4);
+    void advance(int table) {
+        ServerTable& t = tables[table];
+        while (t.state.winner < 0 && t.state.turns < MAX_TABLE_TURNS && t.clients[t.state.currentPlayer] < 0) play(t, -1);
+        bool humans = false;
+        for (int i = 0; i < 4; i++) humans = humans || t.clients[i] >= 0;
+        publish(t);
+        if (t.state.winner >= 0 || t.state.turns >= MAX_TABLE_TURNS || !humans) finish(table);
+        else sendTurn(table);
+    }
 
-            advanceTurn();
+    void sendTurn(int table) {
+        ServerTable& t = tables[table];
+        const GameState& s = t.state;
+        int seat = s.currentPlayer;
+        WireTurn msg;
+        msg.type = WIRE_TURN;
+        msg.size = sizeof(WireTurn);
+        msg.seat = seat;
+        msg.topKind = s.topKind;
+        msg.color = s.currentColor;
+        msg.direction = s.direction > 0;
+        msg.pendingPenalty = min(s.pendingPenalty, 255);
+        msg.drawnKind = s.drawnKind < 0 ? 255 : s.drawnKind;
+        for (int i = 0; i < 4; i++) msg.handSize[i] = min(s.handSize[i], 255);
+        memcpy(msg.hand, s.hands[seat], NUM_KINDS);
+        uint64_t legal = humanActions(s);
+        memcpy(msg.legal, &legal, 8);
+        send(t.clients[seat], &msg, sizeof(msg));
+        armTurnTimer(table);
+    }
+
+    void armTurnTimer(int table) {
+        uint64_t delay = tables[table].state.pendingPenalty > 0 ? stackTicks : turnTicks;
+        if (delay && !timers.active(table)) timers.arm(table, delay);
+    }
+
+    void finish(int table) {
+        ServerTable& t = tables[table];
+        WireResult msg;
+        msg.type = WIRE_RESULT;
+        msg.size = sizeof(WireResult);
+        msg.winner = t.state.winner < 0 ? NO_WINNER : t.state.winner;
+        msg.turns[0] = t.state.turns & 255;
+        msg.turns[1] = t.state.turns >> 8 & 255;
+        for (int i = 0; i < 4; i++) {
+            int fd = t.clients[i];
+            if (fd < 0) continue;
+            msg.seat = i;
+            send(fd, &msg, sizeof(msg));
+            connections[fd].table = -1;
+            t.clients[i] = -1;
+        }
+        msg.seat = SPECTATOR_SEAT;
+        for (int fd : t.spectators) {
+            send(fd, &msg, sizeof(msg));
+            connections[fd].watching = -1;
         }
+        t.spectators.clear();
+        for (int i = 0; i < 4; i++) t.bots[i].reset();
+        timers.cancel(table);
+        t.live = false;
+        freeTables.push_back(table);
+        liveTables--;
+        games++;
     }
+};
 
-    void advanceTurn() {
-        currentPlayer = (currentPlayer + direction + 4) % 4;
+void runServer(string address, string botName, double seconds, double turnSeconds, double stackSeconds, double fillSeconds, bool takeover) {
+    GameServer server(address, botName, turnSeconds, stackSeconds, fillSeconds);
+    if (takeover ? !server.takeover() : !server.start()) {
+        cout << "Could not " << (takeover ? "take over " : "listen on ") << address << endl;
+        return;
     }
+    signal(SIGUSR1, requestDrain);
+    cout << "Serving on " << address << " with " << botName << " bots (kill -USR1 " << getpid() << " to drain)\n";
+    server.run(seconds);
+    cout << "Served " << server.games << " games, " << server.moves << " moves, " << server.timeouts << " timeouts, mean handling "
+         << (server.moves ? server.handledMicros / server.moves : 0) << " us\n";
+}
+
+struct LoadClient {
+    int fd;
+    vector<uint8_t> in;
+    chrono::steady_clock::time_point sent;
+    bool waiting;
+    bool spectator;
 };
 
-int main() {
+void runLoadGenerator(string address, int clients, long long games, int spectators) {
+    raiseFileLimit();
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    vector<LoadClient> pool(clients + spectators);
+    for (auto& c : pool) c.fd = -1;
+    FastRng rng(time(0));
+    long long started = 0, finished = 0, actions = 0, watched = 0, received = 0;
+    WireWatch watch = { WIRE_WATCH, sizeof(WireWatch), { 0xFF, 0xFF, 0xFF, 0xFF } };
+    vector<float> latencies;
+    auto join = [&](int fd) {
+        WireJoin msg = { WIRE_JOIN, sizeof(WireJoin), 0, { 0, 0 } };
+        uint16_t rating = 1300 + rng.below(400);
+        memcpy(msg.rating, &rating, 2);
+        ::send(fd, &msg, sizeof(msg), MSG_NOSIGNAL);
+    };
+    auto begin = chrono::steady_clock::now();
+    int open = 0;
+    for (int i = 0; i < clients && started < games; i++) {
+        LoadClient& c = pool[i];
+        c.fd = connectTo(address);
+        if (c.fd < 0) {
+            cout << "Could not connect to " << address << " (" << i << " clients connected)\n";
+            break;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, c.fd, &ev);
+        c.waiting = false;
+        c.spectator = false;
+        join(c.fd);
+        started++;
+        open++;
+    }
+    for (int i = clients; i < clients + spectators; i++) {
+        LoadClient& c = pool[i];
+        c.fd = connectTo(address);
+        if (c.fd < 0) {
+            cout << "Could not connect spectator " << i - clients << endl;
+            break;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, c.fd, &ev);
+        c.waiting = false;
+        c.spectator = true;
+        ::send(c.fd, &watch, sizeof(watch), MSG_NOSIGNAL);
+    }
+    epoll_event events[512];
+    while (finished < started && open > 0) {
+        int n = epoll_wait(epollFd, events, 512, 5000);
+        if (n <= 0) {
+            cout << "Server stopped responding\n";
+            break;
+        }
+        for (int e = 0; e < n; e++) {
+            LoadClient& c = pool[events[e].data.u32];
+            uint8_t buffer[4096];
+            ssize_t got;
+            while ((got = recv(c.fd, buffer, sizeof(buffer), 0)) > 0) c.in.insert(c.in.end(), buffer, buffer + got);
+            if (got == 0) {
+                close(c.fd);
+                c.fd = -1;
+                if (!c.spectator) open--;
+                continue;
+            }
+            size_t pos = 0;
+            while (c.in.size() - pos >= 2 && c.in.size() - pos >= c.in[pos + 1]) {
+                const uint8_t* msg = &c.in[pos];
+                pos += msg[1];
+                if (c.spectator) {
+                    received++;
+                    if (msg[0] == WIRE_SNAPSHOT) watched++;
+                    const WireResult* result = (const WireResult*)msg;
+                    if (msg[0] == WIRE_RESULT && (result->turns[0] | result->turns[1]) && finished < started)
+                        ::send(c.fd, &watch, sizeof(watch), MSG_NOSIGNAL);
+                    continue;
+                }
+                if (c.waiting) {
+                    latencies.push_back(chrono::duration<float, micro>(chrono::steady_clock::now() - c.sent).count());
+                    c.waiting = false;
+                }
+                if (msg[0] == WIRE_TURN) {
+                    uint64_t legal;
+                    memcpy(&legal, ((const WireTurn*)msg)->legal, 8);
+                    uint64_t plays = legal & ~(1ULL << ACTION_DRAW);
+                    uint64_t options = plays ? plays : legal;
+                    for (int skip = rng.below(__builtin_popcountll(options)); skip > 0; skip--) options &= options - 1;
+                    WireAction act = { WIRE_ACTION, sizeof(WireAction), (uint8_t)__builtin_ctzll(options) };
+                    c.sent = chrono::steady_clock::now();
+                    c.waiting = true;
+                    ::send(c.fd, &act, sizeof(act), MSG_NOSIGNAL);
+                    actions++;
+                } else if (msg[0] == WIRE_RESULT) {
+                    finished++;
+                    if (started < games) {
+                        join(c.fd);
+                        started++;
+                    }
+                }
+            }
+            c.in.erase(c.in.begin(), c.in.begin() + pos);
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    for (auto& c : pool)
+        if (c.fd >= 0) close(c.fd);
+    close(epollFd);
+    sort(latencies.begin(), latencies.end());
+    cout << "Finished " << finished << " games, " << actions << " actions in " << seconds << " s (" << actions / seconds << " actions/s, "
+         << started / seconds << " joins/s)\n";
+    if (spectators > 0) cout << "Spectators watched " << watched << " tables and received " << received << " messages\n";
+    if (!latencies.empty())
+        cout << "Round trip: p50 " << latencies[latencies.size() / 2] << " us | p99 " << latencies[latencies.size() * 99 / 100]
+             << " us | max " << latencies.back() << " us\n";
+}
+#endif
+
+bool runSelfTest() {
+    vector<pair<string, function<string()>>> checks = {
+        { "endgame solver is independent of its table", checkEndgameSolver },
+        { "batched engine matches GameState in lockstep", checkBatchEngine },
+        { "SIMD hand and batch kernels match scalar", checkSimdKernels },
+        { "environment rejects actions outside the mask", checkVecEnv },
+        { "int8 quantize and GEMM kernels match scalar", checkInt8Kernels },
+        { "determinization sampler matches brute force", checkDeterminizationSampler },
+        { "task groups finish nested work and rethrow failures", checkTaskGroup }
+    };
+#ifdef __linux__
+    checks.push_back({ "timer wheel fires each timer on its tick", checkTimerWheel });
+#endif
+    checks.push_back({ "MPMC queue delivers every value once and in order", checkMpmcQueue });
+    checks.push_back({ "game snapshots round-trip in both layouts", checkGameSnapshots });
+    int failed = 0;
+    for (auto& check : checks) {
+        auto start = chrono::steady_clock::now();
+        string error;
+        try {
+            error = check.second();
+        } catch (const exception& e) {
+            error = string("threw ") + e.what();
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (!error.empty()) failed++;
+        cout << (error.empty() ? "ok     " : "FAILED ") << check.first << " (" << ms << " ms)";
+        if (!error.empty()) cout << ": " << error;
+        cout << endl;
+    }
+    cout << checks.size() - failed << "/" << checks.size() << " checks passed\n";
+    return failed == 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "selftest") return runSelfTest() ? 0 : 1;
+    if (argc > 1 && string(argv[1]) == "endgame") {
+        int positions = argc > 2 ? atoi(argv[2]) : 20;
+        int threshold = argc > 3 ? atoi(argv[3]) : ENDGAME_CARDS;
+        int draws = argc > 4 ? atoi(argv[4]) : ENDGAME_DRAWS;
+        runEndgameAnalysis(positions, threshold, draws);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "simulate") {
+        long long games = argc > 2 ? atoll(argv[2]) : 10000;
+        vector<string> names;
+        for (int i = 0; i < 4; i++) names.push_back(argc > 3 + i ? argv[3 + i] : "first");
+        runSimulation(games, names, false);
+        return 0;
+    }
+    if (argc > 3 && string(argv[1]) == "compare") {
+        for (int i = 2; i <= 3; i++)
+            if (!makePolicy(argv[i])) {
+                cout << "Unknown policy: " << argv[i] << endl;
+                return 1;
+            }
+        long long seeds = argc > 4 ? atoll(argv[4]) : 10000;
+        if (seeds < 1) {
+            cout << "Seed count must be at least 1\n";
+            return 1;
+        }
+        bool allDiscard = argc > 5 && atoi(argv[5]) != 0;
+        runPairedComparison(argv[2], argv[3], seeds, allDiscard);
+        return 0;
+    }
+    if (argc > 4 && string(argv[1]) == "sequential") {
+        for (int i = 3; i <= 4; i++)
+            if (!makePolicy(argv[i])) {
+                cout << "Unknown policy: " << argv[i] << endl;
+                return 1;
+            }
+        StopRule rule = { 0.01, false, 0.25, 0.27, 0.05, 0.05, 1000, 10000000 };
+        if (string(argv[2]) == "sprt") {
+            rule.useSprt = true;
+            if (argc > 5) rule.p0 = atof(argv[5]);
+            if (argc > 6) rule.p1 = atof(argv[6]);
+            runSequentialCampaign("winrate", argv[3], argv[4], rule);
+        } else {
+            if (argc > 5) rule.halfWidth = atof(argv[5]);
+            if (argc > 6) rule.maxSamples = atoll(argv[6]);
+            runSequentialCampaign(argv[2], argv[3], argv[4], rule);
+        }
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "batch") {
+        long long games = argc > 2 ? atoll(argv[2]) : 200000;
+        int slots = argc > 3 ? atoi(argv[3]) : 4096;
+        runBatchBenchmark(games, slots);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "env") {
+        int envs = argc > 2 ? atoi(argv[2]) : 1024;
+        int steps = argc > 3 ? atoi(argv[3]) : 1000;
+        runEnvBenchmark(envs, steps);
+        return 0;
+    }
+#ifdef __linux__
+    if (argc > 2 && string(argv[1]) == "ring-produce") {
+        int envs = argc > 3 ? atoi(argv[3]) : 256;
+        int steps = argc > 4 ? atoi(argv[4]) : 1000;
+        runExperienceProducer(argv[2], 1 << 16, envs, steps);
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "ring-consume") {
+        long long count = argc > 3 ? atoll(argv[3]) : 1000000;
+        runExperienceConsumer(argv[2], 1 << 16, count);
+        return 0;
+    }
+    if (argc > 2 && (string(argv[1]) == "serve" || string(argv[1]) == "takeover")) {
+        string bot = argc > 3 ? argv[3] : "greedy";
+        if (!makePolicy(bot)) {
+            cout << "Unknown policy: " << bot << endl;
+            return 1;
+        }
+        runServer(argv[2], bot, argc > 4 ? atof(argv[4]) : 0, argc > 5 ? atof(argv[5]) : 20, argc > 6 ? atof(argv[6]) : 8, argc > 7 ? atof(argv[7]) : 2, string(argv[1]) == "takeover");
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "loadgen") {
+        int clients = argc > 3 ? atoi(argv[3]) : 1000;
+        long long games = argc > 4 ? atoll(argv[4]) : 10000;
+        int spectators = argc > 5 ? atoi(argv[5]) : 0;
+        runLoadGenerator(argv[2], clients, games, spectators);
+        return 0;
+    }
+#endif
+    if (argc > 1 && string(argv[1]) == "coro") {
+        long long games = argc > 2 ? atoll(argv[2]) : 20000;
+        int concurrent = argc > 3 ? atoi(argv[3]) : 10000;
+        int humans = argc > 4 ? atoi(argv[4]) : 1;
+        string bot = argc > 5 ? argv[5] : "greedy";
+        if (!makePolicy(bot)) {
+            cout << "Unknown policy: " << bot << endl;
+            return 1;
+        }
+        runCoroutineGames(games, concurrent, humans, bot);
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "nn-init") {
+        vector<int> sizes = { OBS_SIZE };
+        for (int i = 3; i < argc; i++) sizes.push_back(atoi(argv[i]));
+        if (sizes.size() == 1) sizes = { OBS_SIZE, 128, 128 };
+        sizes.push_back(NUM_ACTIONS);
+        MlpNetwork net;
+        net.randomize(sizes, time(0));
+        net.save(argv[2]);
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "nn-bench") {
+        int envs = argc > 3 ? atoi(argv[3]) : 256;
+        int steps = argc > 4 ? atoi(argv[4]) : 200;
+        runNNBenchmark(argv[2], envs, steps);
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "cfr-train") {
+        unsigned long long iterations = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1000000;
+        string policyPath = argc > 4 ? argv[4] : string(argv[2]) + ".policy";
+        runCfrTraining(argv[2], iterations, policyPath);
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "evolve") {
+        int generations = argc > 3 ? atoi(argv[3]) : 20;
+        int population = argc > 4 ? atoi(argv[4]) : 16;
+        long long seeds = argc > 5 ? atoll(argv[5]) : 2000;
+        string opponent = argc > 6 ? argv[6] : "greedy";
+        uint64_t seed = argc > 7 ? strtoull(argv[7], nullptr, 10) : 1;
+        if (!makePolicy(opponent)) {
+            cout << "Unknown policy: " << opponent << endl;
+            return 1;
+        }
+        runEvolution(argv[2], generations, population, seeds, opponent, seed, string(argv[2]) + ".best.json");
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "tournament") {
+        string format = argc > 2 ? argv[2] : "roundrobin";
+        long long games = argc > 3 ? atoll(argv[3]) : 6000;
+        vector<string> names;
+        for (int i = 4; i < argc; i++) names.push_back(argv[i]);
+        if (names.empty()) names = { "first", "random", "greedy", "endgame" };
+        for (string n : names)
+            if (!makePolicy(n)) {
+                cout << "Unknown policy: " << n << endl;
+                return 1;
+            }
+        Tournament t(names, games);
+        if (format == "swiss") t.swiss((int)ceil(log2((double)names.size())) + 1);
+        else t.roundRobin();
+        return 0;
+    }
+
+    string bot = argc > 2 && string(argv[1]) == "play" ? argv[2] : "";
+    if (!bot.empty() && !makePolicy(bot)) {
+        cout << "Unknown policy: " << bot << endl;
+        return 1;
+    }
     string name;
     cout << "Enter your name: ";
     cin >> name;
+    json player = loadPlayerData(name);
+    string checkpoint = "checkpoint_" + name + ".bin";
+    ifstream saved(checkpoint, ios::binary);
+    if (saved) {
+        vector<uint8_t> bytes((istreambuf_iterator<char>(saved)), istreambuf_iterator<char>());
+        saved.close();
+        int resume = 0;
+        cout << "Resume your unfinished game? (1 = Yes, 0 = No): ";
+        cin >> resume;
+        if (resume) {
+            try {
+                Game g(name, player, bytes, false, bot);
+                g.checkpointPath = checkpoint;
+                g.checkpointEvery = CHECKPOINT_TURNS;
+                g.mainLoop();
+                savePlayerData(player);
+                return 0;
+            } catch (const runtime_error& e) {
+                cout << "Could not resume: " << e.what() << endl;
+            }
+        }
+        remove(checkpoint.c_str());
+    }
     bool enableAllDiscard;
     cout << "Enable All Discard rule? (1 = Yes, 0 = No): ";
     cin >> enableAllDiscard;
 
-    json player = loadPlayerData(name);
-    Game g(name, player, enableAllDiscard);
+    Game g(name, player, enableAllDiscard, false, bot);
+    g.checkpointPath = checkpoint;
+    g.checkpointEvery = CHECKPOINT_TURNS;
+    savePlayerData(player);
+    g.mainLoop();
     savePlayerData(player);
     return 0;
 }